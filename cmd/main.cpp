@@ -1,6 +1,10 @@
 //  project internal
 #include "waveguide.h"
+#include "native_waveguide.h"
+#include "distributed_waveguide.h"
+#include "streaming_waveguide.h"
 #include "scene_data.h"
+#include "scene_optimization.h"
 #include "test_flag.h"
 #include "conversions.h"
 
@@ -29,6 +33,7 @@
 #include <numeric>
 #include <cmath>
 #include <map>
+#include <memory>
 
 using namespace std;
 using namespace rapidjson;
@@ -101,6 +106,13 @@ vector<float> exponential_decay_envelope(int steps, float attenuation_factor) {
     return ret;
 }
 
+template <typename T>
+auto elapsed_ms(const T & start) {
+    return chrono::duration_cast<chrono::milliseconds>(
+               chrono::steady_clock::now() - start)
+        .count();
+}
+
 bool all_zero(const vector<float> & t) {
     auto ret = true;
     for (auto i = 0u; i != t.size(); ++i) {
@@ -161,6 +173,29 @@ int main(int argc, char ** argv) {
     auto trim_tail = false;
     auto remove_direct = false;
     auto volume_scale = 1.0;
+    auto sort_rays = false;
+    auto force_global_memory = false;
+    auto receiver_radius = 0.0f;
+    auto visibility_map_resolution = 0;
+    auto optimize_geometry = false;
+    auto lod_levels = 0;
+    auto image_source_order = 0;
+    auto lod_order = 16;
+    auto lod_ratio = 0.25f;
+    auto implicit_waveguide = false;
+    auto morton_order = false;
+    auto rectilinear_waveguide = false;
+    auto native_waveguide = false;
+    auto native_threads = 0;
+    auto native_blocking_factor = 1;
+    auto waveguide_devices = 1;
+    auto streaming_waveguide = false;
+    auto streaming_slab_nodes = 1 << 22;
+    auto streaming_blocking_factor = 8;
+    auto waveguide_steps_per_sync = 512;
+    auto waveguide_active_region = false;
+    auto waveguide_decay_db = 0.0f;
+    auto waveguide_half_precision = false;
 
     auto directions = getRandomDirections(num_rays);
     cl_float3 source{{0, 2, 0}};
@@ -198,6 +233,34 @@ int main(int argc, char ** argv) {
     cv.addOptionalValidator("trim_predelay", trim_predelay);
     cv.addOptionalValidator("remove_direct", remove_direct);
     cv.addOptionalValidator("trim_tail", trim_tail);
+    cv.addOptionalValidator("sort_rays", sort_rays);
+    cv.addOptionalValidator("force_global_memory", force_global_memory);
+    cv.addOptionalValidator("receiver_radius", receiver_radius);
+    cv.addOptionalValidator("visibility_map_resolution",
+                            visibility_map_resolution);
+    cv.addOptionalValidator("optimize_scene", optimize_geometry);
+    cv.addOptionalValidator("lod_levels", lod_levels);
+    cv.addOptionalValidator("image_source_order", image_source_order);
+    cv.addOptionalValidator("lod_order", lod_order);
+    cv.addOptionalValidator("lod_ratio", lod_ratio);
+    cv.addOptionalValidator("implicit_waveguide", implicit_waveguide);
+    cv.addOptionalValidator("morton_order", morton_order);
+    cv.addOptionalValidator("rectilinear_waveguide", rectilinear_waveguide);
+    cv.addOptionalValidator("native_waveguide", native_waveguide);
+    cv.addOptionalValidator("native_threads", native_threads);
+    cv.addOptionalValidator("native_blocking_factor", native_blocking_factor);
+    cv.addOptionalValidator("waveguide_devices", waveguide_devices);
+    cv.addOptionalValidator("streaming_waveguide", streaming_waveguide);
+    cv.addOptionalValidator("streaming_slab_nodes", streaming_slab_nodes);
+    cv.addOptionalValidator("streaming_blocking_factor",
+                            streaming_blocking_factor);
+    cv.addOptionalValidator("waveguide_steps_per_sync",
+                            waveguide_steps_per_sync);
+    cv.addOptionalValidator("waveguide_active_region",
+                            waveguide_active_region);
+    cv.addOptionalValidator("waveguide_decay_db", waveguide_decay_db);
+    cv.addOptionalValidator("waveguide_half_precision",
+                            waveguide_half_precision);
 
     try {
         cv.run(document);
@@ -208,23 +271,131 @@ int main(int argc, char ** argv) {
 
     try {
         SceneData scene_data(model_file, material_file);
+        if (optimize_geometry) {
+            auto optimized = optimize_scene(scene_data);
+            Logger::log("optimized scene from ",
+                        optimized.triangles_before,
+                        " to ",
+                        optimized.triangles_after,
+                        " triangles, and from ",
+                        optimized.vertices_before,
+                        " to ",
+                        optimized.vertices_after,
+                        " vertices");
+        }
 
         auto boundary = get_mesh_boundary(scene_data);
-        auto waveguide_program =
-            get_program<TetrahedralProgram>(context, device);
-        IterativeTetrahedralWaveguide waveguide(
-            waveguide_program, queue, boundary, divisions);
-        auto mic_index = waveguide.get_index_for_coordinate(convert(mic));
-        auto source_index = waveguide.get_index_for_coordinate(convert(source));
-
-        auto corrected_mic = waveguide.get_coordinate_for_index(mic_index);
+        //  the rectilinear scheme at its Courant limit has the same node
+        //  spacing for a given sampling rate as the tetrahedral scheme
+        unique_ptr<BasicWaveguide> waveguide;
+        if (native_waveguide) {
+            waveguide = make_unique<NativeTetrahedralWaveguide>(
+                boundary,
+                divisions,
+                max(native_threads, 0),
+                max(native_blocking_factor, 1));
+        } else if (streaming_waveguide) {
+            waveguide = make_unique<StreamingTetrahedralWaveguide>(
+                get_program<TetrahedralProgram>(context, device),
+                queue,
+                boundary,
+                divisions,
+                max(streaming_slab_nodes, 1),
+                max(streaming_blocking_factor, 1));
+        } else if (waveguide_devices > 1) {
+            auto slab_devices = get_devices(context, device, waveguide_devices);
+            vector<TetrahedralProgram> programs;
+            vector<cl::CommandQueue> queues;
+            for (const auto & i : slab_devices.second) {
+                programs.push_back(get_program<TetrahedralProgram>(
+                    slab_devices.first, i));
+                queues.emplace_back(slab_devices.first, i);
+            }
+            waveguide = make_unique<DistributedTetrahedralWaveguide>(
+                programs, queues, boundary, divisions);
+        } else if (rectilinear_waveguide) {
+            waveguide = make_unique<RectilinearWaveguide>(
+                get_program<RectilinearProgram>(context, device),
+                queue,
+                boundary,
+                divisions,
+                waveguide_half_precision);
+        } else if (implicit_waveguide) {
+            waveguide = make_unique<ImplicitTetrahedralWaveguide>(
+                get_program<TetrahedralProgram>(context, device),
+                queue,
+                boundary,
+                divisions);
+        } else {
+            waveguide = make_unique<IterativeTetrahedralWaveguide>(
+                get_program<TetrahedralProgram>(context, device),
+                queue,
+                boundary,
+                divisions,
+                morton_order,
+                waveguide_half_precision);
+        }
+        auto mic_index = waveguide->get_index_for_coordinate(convert(mic));
+        auto source_index =
+            waveguide->get_index_for_coordinate(convert(source));
+
+        auto corrected_mic = waveguide->get_coordinate_for_index(mic_index);
         auto corrected_source =
-            waveguide.get_coordinate_for_index(source_index);
+            waveguide->get_coordinate_for_index(source_index);
 
         auto raytrace_program = get_program<RayverbProgram>(context, device);
         Raytrace raytrace(raytrace_program, queue, num_impulses, scene_data);
+        raytrace.setSortRays(sort_rays);
+        if (force_global_memory)
+            raytrace.setUseLocalMemory(false);
+        if (receiver_radius > 0)
+            raytrace.setReceiverModel(
+                ReceiverModel{ReceiverModel::SPHERE, receiver_radius});
+        if (image_source_order > 0)
+            raytrace.setImageSourceOrder(image_source_order);
+        if (visibility_map_resolution > 0) {
+            raytrace.setVisibilityMapResolution(visibility_map_resolution);
+
+            auto visibility_start = chrono::steady_clock::now();
+            raytrace.prepareVisibilityMap(convert(corrected_mic));
+            queue.finish();
+            Logger::log("visibility map (resolution: ",
+                        visibility_map_resolution,
+                        ") took: ",
+                        elapsed_ms(visibility_start),
+                        " ms");
+        }
+
+        if (lod_levels > 0) {
+            //  level n is used from reflection n * lod_order onwards
+            auto chain = build_lod_chain(scene_data, lod_levels, lod_ratio);
+            vector<LevelOfDetail> levels;
+            for (auto i = 0u; i != chain.size(); ++i) {
+                Logger::log("level of detail ",
+                            i + 1,
+                            ": ",
+                            chain[i].triangles.size(),
+                            " triangles");
+                levels.push_back(
+                    LevelOfDetail{(i + 1) * lod_order, chain[i]});
+            }
+            raytrace.setLevelsOfDetail(levels);
+        }
+
+        auto raytrace_start = chrono::steady_clock::now();
         raytrace.raytrace(
             convert(corrected_mic), convert(corrected_source), directions);
+        Logger::log("raytrace (sort rays: ",
+                    sort_rays,
+                    ", local memory: ",
+                    raytrace.getUseLocalMemory(),
+                    ", receiver radius: ",
+                    receiver_radius,
+                    ", image source order: ",
+                    image_source_order,
+                    ") took: ",
+                    elapsed_ms(raytrace_start),
+                    " ms");
         auto results = raytrace.getAllRaw(false);
         vector<Speaker> speakers{Speaker{cl_float3{{0, 0, 0}}, 0}};
         auto attenuated =
@@ -272,8 +443,21 @@ int main(int argc, char ** argv) {
         auto steps = 1 << 13;
 #endif
 
+        waveguide->set_steps_per_sync(max(waveguide_steps_per_sync, 1));
+        waveguide->set_active_region(waveguide_active_region);
+        waveguide->set_decay_threshold(waveguide_decay_db);
+        auto waveguide_start = chrono::steady_clock::now();
         auto w_results =
-            waveguide.run_basic(corrected_source, mic_index, steps);
+            waveguide->run_basic(corrected_source, mic_index, steps);
+        Logger::log("waveguide (",
+                    w_results.size(),
+                    " of ",
+                    steps,
+                    " steps, steps per sync: ",
+                    waveguide->get_steps_per_sync(),
+                    ") took: ",
+                    elapsed_ms(waveguide_start),
+                    " ms");
 
         normalize(w_results);
 
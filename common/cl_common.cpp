@@ -34,3 +34,32 @@ cl::Device get_device(const cl::Context & context) {
 
     return device;
 }
+
+pair<cl::Context, vector<cl::Device>> get_devices(const cl::Context & context,
+                                                  const cl::Device & device,
+                                                  unsigned count) {
+    auto devices = context.getInfo<CL_CONTEXT_DEVICES>();
+    if (count <= devices.size()) {
+        devices.resize(count);
+        return make_pair(context, devices);
+    }
+
+    auto units = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() / count;
+    if (units == 0)
+        throw runtime_error("device has too few compute units to split");
+
+    cl_device_partition_property properties[] = {
+        CL_DEVICE_PARTITION_EQUALLY, units, 0};
+    auto parent = device;
+    vector<cl::Device> sub_devices;
+    parent.createSubDevices(properties, &sub_devices);
+    sub_devices.resize(count);
+
+    Logger::log("split device into ",
+                count,
+                " sub-devices with ",
+                units,
+                " compute units each");
+
+    return make_pair(cl::Context(sub_devices), sub_devices);
+}
@@ -5,12 +5,29 @@
 #define __CL_ENABLE_EXCEPTIONS
 #include "cl.hpp"
 
+#include <utility>
+
 using namespace std;
 
 void print_device_info(const cl::Device & i);
 cl::Context get_context();
 cl::Device get_device(const cl::Context & context);
 
+/// Get count devices to share work between, and a context containing them.
+/// The devices in context are used if there are enough of them, otherwise
+/// device is split into count sub-devices with equal compute units.
+pair<cl::Context, vector<cl::Device>> get_devices(const cl::Context & context,
+                                                  const cl::Device & device,
+                                                  unsigned count);
+
+/// Buffers can't be empty, so an empty vector gets a null buffer, which
+/// must never be passed to a kernel.
+template <typename T>
+cl::Buffer make_buffer(const cl::Context & context, const vector<T> & data) {
+    return data.empty() ? cl::Buffer()
+                        : cl::Buffer(context, data.begin(), data.end(), true);
+}
+
 template <typename T>
 T get_program(const cl::Context & context, const cl::Device & device) {
     T program(context);
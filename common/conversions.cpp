@@ -2,6 +2,9 @@
 
 #include "vec.h"
 
+#include <cmath>
+#include <cstring>
+
 #define VEC_CONVERT_FUNCTIONS_DEFINITION(t) \
     cl_##t##3 convert(const Vec3<t> & v) {  \
         return {{v.x, v.y, v.z}};           \
@@ -16,3 +19,51 @@ VEC_CONVERT_FUNCTIONS_DEFINITION(int)
 cl_float3 convert(const aiVector3D & v) {
     return {{v.x, v.y, v.z}};
 }
+
+cl_half float_to_half(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    //  infinity, or nan with a mantissa bit set so it stays a nan
+    if (exponent == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+    auto rounded = [](uint32_t value, uint32_t shift) {
+        auto ret = value >> shift;
+        auto remainder = value & ((1u << shift) - 1);
+        auto halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (ret & 1)))
+            ret += 1;
+        return ret;
+    };
+
+    int half_exponent = int(exponent) - 127 + 15;
+    if (31 <= half_exponent)
+        return sign | 0x7c00;
+
+    //  below half the smallest subnormal, which rounds to zero
+    if (half_exponent < -10)
+        return sign;
+
+    //  subnormal, where rounding up may give the smallest normal number
+    if (half_exponent <= 0)
+        return sign | rounded(mantissa | 0x800000, 14 - half_exponent);
+
+    //  rounding up may carry into the exponent, or overflow to infinity
+    return sign | rounded((half_exponent << 23) | mantissa, 13);
+}
+
+float half_to_float(cl_half h) {
+    auto sign = h & 0x8000 ? -1.0f : 1.0f;
+    int exponent = (h >> 10) & 0x1f;
+    int mantissa = h & 0x3ff;
+
+    if (exponent == 0x1f)
+        return mantissa ? NAN : sign * INFINITY;
+    if (exponent == 0)
+        return sign * ldexp(float(mantissa), -24);
+    return sign * ldexp(float(mantissa | 0x400), exponent - 25);
+}
@@ -16,3 +16,9 @@ VEC_CONVERT_FUNCTIONS_DECLARATION(float)
 VEC_CONVERT_FUNCTIONS_DECLARATION(int)
 
 cl_float3 convert(const aiVector3D & v);
+
+/// Convert to IEEE 754 half precision, rounding to nearest even like
+/// vstore_half with the default rounding mode.
+cl_half float_to_half(float f);
+
+float half_to_float(cl_half h);
@@ -66,6 +66,14 @@ SceneData::SceneData(const aiScene * const scene, const string & mat_file) {
     populate(scene, mat_file);
 }
 
+SceneData::SceneData(const vector<Triangle> & triangles,
+                     const vector<cl_float3> & vertices,
+                     const vector<Surface> & surfaces)
+        : triangles(triangles)
+        , vertices(vertices)
+        , surfaces(surfaces) {
+}
+
 void SceneData::populate(const aiScene * const scene, const string & mat_file) {
     if (!scene)
         throw runtime_error("scene pointer is null");
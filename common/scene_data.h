@@ -53,6 +53,9 @@ public:
 
     SceneData(const std::string & fpath, const std::string & mat_file);
     SceneData(const aiScene * const scene, const std::string & mat_file);
+    SceneData(const std::vector<Triangle> & triangles,
+              const std::vector<cl_float3> & vertices,
+              const std::vector<Surface> & surfaces);
     virtual ~SceneData() noexcept = default;
     void populate(const aiScene * const scene, const std::string & mat_file);
     void populate(const std::string & fpath, const std::string & mat_file);
@@ -0,0 +1,558 @@
+#include "scene_optimization.h"
+
+#include "conversions.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <queue>
+#include <set>
+#include <stdexcept>
+#include <tuple>
+
+using namespace std;
+
+namespace {
+
+Vec3f get_vertex(const SceneData & scene, cl_ulong i) {
+    return convert(scene.vertices[i]);
+}
+
+Vec3f triangle_cross(const SceneData & scene, const Triangle & t) {
+    auto v0 = get_vertex(scene, t.v0);
+    return (get_vertex(scene, t.v1) - v0).cross(get_vertex(scene, t.v2) - v0);
+}
+
+Vec3f triangle_normal(const SceneData & scene, const Triangle & t) {
+    auto c = triangle_cross(scene, t);
+    return c / c.mag();
+}
+
+bool uses_vertex(const Triangle & t, cl_ulong v) {
+    return t.v0 == v || t.v1 == v || t.v2 == v;
+}
+
+Triangle replace_vertex(Triangle t, cl_ulong from, cl_ulong to) {
+    for (auto i : {&t.v0, &t.v1, &t.v2})
+        if (*i == from)
+            *i = to;
+    return t;
+}
+
+/// Returns the vertices which are collapse targets for v, or an empty vector
+/// if v cannot be removed without changing the shape of the scene.
+vector<cl_ulong> collapse_candidates(const SceneData & scene,
+                                     const vector<cl_ulong> & fan,
+                                     cl_ulong v,
+                                     float tolerance) {
+    const auto & first = scene.triangles[fan.front()];
+    auto normal = triangle_normal(scene, first);
+
+    map<cl_ulong, int> edge_count;
+    for (auto i : fan) {
+        const auto & t = scene.triangles[i];
+        if (t.surface != first.surface ||
+            triangle_normal(scene, t).dot(normal) < 1 - tolerance)
+            return vector<cl_ulong>();
+
+        for (auto j : {t.v0, t.v1, t.v2})
+            if (j != v)
+                edge_count[j] += 1;
+    }
+
+    vector<cl_ulong> interior;
+    vector<cl_ulong> boundary;
+    for (const auto & i : edge_count) {
+        if (i.second == 1)
+            boundary.push_back(i.first);
+        else if (i.second == 2)
+            interior.push_back(i.first);
+        else
+            return vector<cl_ulong>();
+    }
+
+    if (boundary.empty())
+        return interior;
+
+    if (boundary.size() != 2)
+        return vector<cl_ulong>();
+
+    //  v is on the edge of the region, so it can only be removed if it lies
+    //  on a straight line between its neighbours on the edge
+    auto p = get_vertex(scene, v);
+    auto a = get_vertex(scene, boundary[0]) - p;
+    auto b = get_vertex(scene, boundary[1]) - p;
+    a = a / a.mag();
+    b = b / b.mag();
+    if (a.dot(b) < 0 && a.cross(b).mag() < tolerance)
+        return boundary;
+    return vector<cl_ulong>();
+}
+
+/// Returns true if collapsing v into u leaves every remaining triangle in the
+/// fan facing the same way, with non-zero area.
+bool collapse_is_valid(const SceneData & scene,
+                       const vector<cl_ulong> & fan,
+                       cl_ulong v,
+                       cl_ulong u,
+                       float tolerance) {
+    auto normal = triangle_normal(scene, scene.triangles[fan.front()]);
+    for (auto i : fan) {
+        const auto & t = scene.triangles[i];
+        if (uses_vertex(t, u))
+            continue;
+        auto c = triangle_cross(scene, replace_vertex(t, v, u));
+        auto mag = c.mag();
+        if (mag == 0 || (c / mag).dot(normal) < 1 - tolerance)
+            return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+void weld_vertices(SceneData & scene, float weld_distance) {
+    if (!(0 < weld_distance))
+        throw runtime_error("weld distance must be positive");
+
+    //  vertices are bucketed into cells of the weld distance, so any vertex
+    //  within the weld distance is in the same cell or a neighbouring one
+    auto get_cell = [weld_distance](const Vec3f & v) {
+        return make_tuple(lround(floor(v.x / weld_distance)),
+                          lround(floor(v.y / weld_distance)),
+                          lround(floor(v.z / weld_distance)));
+    };
+
+    vector<cl_ulong> parent(scene.vertices.size());
+    iota(parent.begin(), parent.end(), 0);
+    auto find_root = [&parent](cl_ulong i) {
+        while (parent[i] != i)
+            i = parent[i] = parent[parent[i]];
+        return i;
+    };
+
+    map<tuple<long, long, long>, vector<cl_ulong>> cells;
+    for (auto i = 0u; i != scene.vertices.size(); ++i) {
+        auto v = get_vertex(scene, i);
+        auto cell = get_cell(v);
+        for (auto x = -1; x != 2; ++x) {
+            for (auto y = -1; y != 2; ++y) {
+                for (auto z = -1; z != 2; ++z) {
+                    auto it = cells.find(make_tuple(get<0>(cell) + x,
+                                                    get<1>(cell) + y,
+                                                    get<2>(cell) + z));
+                    if (it == cells.end())
+                        continue;
+                    for (auto j : it->second) {
+                        if ((get_vertex(scene, j) - v).mag() <= weld_distance)
+                            parent[find_root(i)] = find_root(j);
+                    }
+                }
+            }
+        }
+        cells[cell].push_back(i);
+    }
+
+    //  each group of welded vertices takes the position of its first vertex
+    vector<cl_ulong> remap(scene.vertices.size());
+    map<cl_ulong, cl_ulong> roots;
+    vector<cl_float3> vertices;
+    for (auto i = 0u; i != scene.vertices.size(); ++i) {
+        auto it = roots.find(find_root(i));
+        if (it == roots.end()) {
+            it = roots.insert(make_pair(find_root(i), vertices.size())).first;
+            vertices.push_back(scene.vertices[i]);
+        }
+        remap[i] = it->second;
+    }
+
+    for (auto & t : scene.triangles) {
+        t.v0 = remap[t.v0];
+        t.v1 = remap[t.v1];
+        t.v2 = remap[t.v2];
+    }
+    scene.vertices = vertices;
+}
+
+void remove_degenerate_triangles(SceneData & scene, float min_area) {
+    //  keyed on the vertices in winding order, starting from the lowest, and
+    //  the surface, so only exact duplicates are removed
+    set<array<cl_ulong, 4>> seen;
+    vector<Triangle> triangles;
+
+    for (const auto & t : scene.triangles) {
+        if (t.v0 == t.v1 || t.v1 == t.v2 || t.v2 == t.v0)
+            continue;
+        if (triangle_cross(scene, t).mag() / 2 < min_area)
+            continue;
+
+        array<cl_ulong, 3> v{{t.v0, t.v1, t.v2}};
+        rotate(v.begin(), min_element(v.begin(), v.end()), v.end());
+        if (!seen.insert(array<cl_ulong, 4>{{v[0], v[1], v[2], t.surface}})
+                 .second)
+            continue;
+
+        triangles.push_back(t);
+    }
+    scene.triangles = triangles;
+}
+
+void merge_coplanar_triangles(SceneData & scene, float tolerance) {
+    for (auto changed = true; changed;) {
+        changed = false;
+
+        vector<vector<cl_ulong>> fans(scene.vertices.size());
+        for (auto i = 0u; i != scene.triangles.size(); ++i) {
+            const auto & t = scene.triangles[i];
+            for (auto j : {t.v0, t.v1, t.v2})
+                fans[j].push_back(i);
+        }
+
+        //  A vertex whose fan has been modified in this pass is skipped until
+        //  the fans are rebuilt.
+        vector<bool> touched(scene.vertices.size(), false);
+        vector<bool> removed(scene.triangles.size(), false);
+
+        for (auto v = 0u; v != scene.vertices.size(); ++v) {
+            const auto & fan = fans[v];
+            if (touched[v] || fan.empty())
+                continue;
+
+            auto candidates =
+                collapse_candidates(scene, fan, v, tolerance);
+            auto u = find_if(candidates.begin(),
+                             candidates.end(),
+                             [&](auto u) {
+                                 return !touched[u] &&
+                                        collapse_is_valid(
+                                            scene, fan, v, u, tolerance);
+                             });
+            if (u == candidates.end())
+                continue;
+
+            for (auto i : fan) {
+                auto & t = scene.triangles[i];
+                for (auto j : {t.v0, t.v1, t.v2})
+                    touched[j] = true;
+                if (uses_vertex(t, *u))
+                    removed[i] = true;
+                else
+                    t = replace_vertex(t, v, *u);
+            }
+            changed = true;
+        }
+
+        vector<Triangle> triangles;
+        for (auto i = 0u; i != scene.triangles.size(); ++i)
+            if (!removed[i])
+                triangles.push_back(scene.triangles[i]);
+        scene.triangles = triangles;
+    }
+}
+
+void remove_unused_vertices(SceneData & scene) {
+    vector<bool> used(scene.vertices.size(), false);
+    for (const auto & t : scene.triangles)
+        for (auto j : {t.v0, t.v1, t.v2})
+            used[j] = true;
+
+    vector<cl_ulong> remap(scene.vertices.size());
+    vector<cl_float3> vertices;
+    for (auto i = 0u; i != scene.vertices.size(); ++i) {
+        if (used[i]) {
+            remap[i] = vertices.size();
+            vertices.push_back(scene.vertices[i]);
+        }
+    }
+
+    for (auto & t : scene.triangles) {
+        t.v0 = remap[t.v0];
+        t.v1 = remap[t.v1];
+        t.v2 = remap[t.v2];
+    }
+    scene.vertices = vertices;
+}
+
+SceneOptimizationResults optimize_scene(SceneData & scene,
+                                        float weld_distance,
+                                        float tolerance) {
+    SceneOptimizationResults ret;
+    ret.vertices_before = scene.vertices.size();
+    ret.triangles_before = scene.triangles.size();
+
+    weld_vertices(scene, weld_distance);
+    remove_degenerate_triangles(scene, weld_distance * weld_distance);
+    merge_coplanar_triangles(scene, tolerance);
+    remove_degenerate_triangles(scene, weld_distance * weld_distance);
+    remove_unused_vertices(scene);
+
+    ret.vertices_after = scene.vertices.size();
+    ret.triangles_after = scene.triangles.size();
+    return ret;
+}
+
+namespace {
+
+/// A symmetric 4x4 matrix, stored as its upper triangle.
+using Quadric = array<double, 10>;
+
+Quadric plane_quadric(const Vec3f & normal, const Vec3f & point, double w) {
+    double a = normal.x, b = normal.y, c = normal.z, d = -normal.dot(point);
+    return Quadric{{w * a * a,
+                    w * a * b,
+                    w * a * c,
+                    w * a * d,
+                    w * b * b,
+                    w * b * c,
+                    w * b * d,
+                    w * c * c,
+                    w * c * d,
+                    w * d * d}};
+}
+
+Quadric operator+(const Quadric & a, const Quadric & b) {
+    Quadric ret;
+    transform(a.begin(), a.end(), b.begin(), ret.begin(), plus<double>());
+    return ret;
+}
+
+double quadric_error(const Quadric & q, const Vec3f & p) {
+    double x = p.x, y = p.y, z = p.z;
+    return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+           q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y + q[7] * z * z +
+           2 * q[8] * z + q[9];
+}
+
+/// A possible edge collapse, where remove is merged into keep, and keep is
+/// moved to position.
+struct Collapse {
+    double cost;
+    cl_ulong keep;
+    cl_ulong remove;
+    Vec3f position;
+    unsigned long keep_stamp;
+    unsigned long remove_stamp;
+
+    bool operator<(const Collapse & rhs) const {
+        return cost > rhs.cost;
+    }
+};
+
+class Decimator {
+public:
+    Decimator(const SceneData & scene)
+            : scene(scene)
+            , alive(scene.triangles.size(), true)
+            , fans(scene.vertices.size())
+            , quadrics(scene.vertices.size(), Quadric())
+            , locked(scene.vertices.size(), false)
+            , stamps(scene.vertices.size(), 0) {
+        for (auto i = 0u; i != scene.triangles.size(); ++i) {
+            const auto & t = scene.triangles[i];
+            auto c = triangle_cross(scene, t);
+            auto area = c.mag() / 2;
+            if (area == 0)
+                continue;
+            auto q = plane_quadric(
+                c / c.mag(), get_vertex(scene, t.v0), area);
+            for (auto j : {t.v0, t.v1, t.v2}) {
+                fans[j].insert(i);
+                quadrics[j] = quadrics[j] + q;
+            }
+        }
+
+        for (auto v = 0u; v != fans.size(); ++v) {
+            map<cl_ulong, int> edge_count;
+            set<cl_ulong> surfaces;
+            for (auto i : fans[v]) {
+                const auto & t = scene.triangles[i];
+                surfaces.insert(t.surface);
+                for (auto j : {t.v0, t.v1, t.v2})
+                    if (j != v)
+                        edge_count[j] += 1;
+            }
+            locked[v] = 1 < surfaces.size() ||
+                        any_of(edge_count.begin(),
+                               edge_count.end(),
+                               [](const auto & i) { return i.second != 2; });
+        }
+
+        for (auto v = 0u; v != fans.size(); ++v)
+            push_edges(v);
+    }
+
+    SceneData run(SceneData::size_type target_triangles) {
+        auto remaining = count_live();
+        while (target_triangles < remaining && !queue.empty()) {
+            auto c = queue.top();
+            queue.pop();
+            if (c.keep_stamp != stamps[c.keep] ||
+                c.remove_stamp != stamps[c.remove])
+                continue;
+            if (!can_collapse(c))
+                continue;
+            remaining -= collapse(c);
+        }
+
+        SceneData ret(scene);
+        ret.triangles.clear();
+        for (auto i = 0u; i != scene.triangles.size(); ++i)
+            if (alive[i])
+                ret.triangles.push_back(scene.triangles[i]);
+        remove_unused_vertices(ret);
+        return ret;
+    }
+
+private:
+    SceneData::size_type count_live() const {
+        return count(alive.begin(), alive.end(), true);
+    }
+
+    set<cl_ulong> neighbours(cl_ulong v) const {
+        set<cl_ulong> ret;
+        for (auto i : fans[v]) {
+            const auto & t = scene.triangles[i];
+            for (auto j : {t.v0, t.v1, t.v2})
+                if (j != v)
+                    ret.insert(j);
+        }
+        return ret;
+    }
+
+    void push_edges(cl_ulong v) {
+        for (auto u : neighbours(v)) {
+            Collapse c;
+            if (!best_collapse(v, u, c))
+                continue;
+            queue.push(c);
+        }
+    }
+
+    bool best_collapse(cl_ulong a, cl_ulong b, Collapse & c) const {
+        if (locked[a] && locked[b])
+            return false;
+
+        auto q = quadrics[a] + quadrics[b];
+        auto pa = get_vertex(scene, a);
+        auto pb = get_vertex(scene, b);
+
+        vector<tuple<cl_ulong, cl_ulong, Vec3f>> options;
+        if (locked[a]) {
+            options.emplace_back(a, b, pa);
+        } else if (locked[b]) {
+            options.emplace_back(b, a, pb);
+        } else {
+            options.emplace_back(a, b, pa);
+            options.emplace_back(b, a, pb);
+            options.emplace_back(a, b, (pa + pb) / 2);
+        }
+
+        c = Collapse{numeric_limits<double>::infinity(), a, b, pa, 0, 0};
+        for (const auto & i : options) {
+            auto cost = quadric_error(q, get<2>(i));
+            if (cost < c.cost) {
+                c.cost = cost;
+                c.keep = get<0>(i);
+                c.remove = get<1>(i);
+                c.position = get<2>(i);
+            }
+        }
+        c.keep_stamp = stamps[c.keep];
+        c.remove_stamp = stamps[c.remove];
+        return true;
+    }
+
+    /// Checks that the collapse won't create non-manifold geometry or flip
+    /// any triangles.
+    bool can_collapse(const Collapse & c) const {
+        auto shared = 0;
+        for (auto i : fans[c.remove])
+            shared += uses_vertex(scene.triangles[i], c.keep);
+
+        auto a = neighbours(c.keep);
+        auto b = neighbours(c.remove);
+        vector<cl_ulong> common;
+        set_intersection(
+            a.begin(), a.end(), b.begin(), b.end(), back_inserter(common));
+        if (common.size() != static_cast<size_t>(shared))
+            return false;
+
+        auto moved = [this, &c](auto v) {
+            return v == c.keep ? c.position : get_vertex(scene, v);
+        };
+        for (auto v : {c.keep, c.remove}) {
+            for (auto i : fans[v]) {
+                const auto & t = scene.triangles[i];
+                if (uses_vertex(t, c.keep) && uses_vertex(t, c.remove))
+                    continue;
+                auto before = triangle_cross(scene, t);
+                auto r = replace_vertex(t, c.remove, c.keep);
+                auto after = (moved(r.v1) - moved(r.v0))
+                                 .cross(moved(r.v2) - moved(r.v0));
+                if (after.mag() == 0 || after.dot(before) <= 0)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    /// Returns the number of triangles removed.
+    int collapse(const Collapse & c) {
+        auto ret = 0;
+        scene.vertices[c.keep] = convert(c.position);
+        quadrics[c.keep] = quadrics[c.keep] + quadrics[c.remove];
+        for (auto i : fans[c.remove]) {
+            auto & t = scene.triangles[i];
+            if (uses_vertex(t, c.keep)) {
+                alive[i] = false;
+                for (auto j : {t.v0, t.v1, t.v2})
+                    if (j != c.remove)
+                        fans[j].erase(i);
+                ret += 1;
+            } else {
+                t = replace_vertex(t, c.remove, c.keep);
+                fans[c.keep].insert(i);
+            }
+        }
+        fans[c.remove].clear();
+
+        stamps[c.keep] += 1;
+        stamps[c.remove] += 1;
+        for (auto v : neighbours(c.keep))
+            stamps[v] += 1;
+        for (auto v : neighbours(c.keep))
+            push_edges(v);
+        push_edges(c.keep);
+        return ret;
+    }
+
+    SceneData scene;
+    vector<bool> alive;
+    vector<set<cl_ulong>> fans;
+    vector<Quadric> quadrics;
+    vector<bool> locked;
+    vector<unsigned long> stamps;
+    priority_queue<Collapse> queue;
+};
+
+}  // namespace
+
+SceneData simplify_scene(const SceneData & scene,
+                         SceneData::size_type target_triangles) {
+    return Decimator(scene).run(target_triangles);
+}
+
+vector<SceneData> build_lod_chain(const SceneData & scene,
+                                  unsigned levels,
+                                  float ratio) {
+    vector<SceneData> ret;
+    for (auto i = 0u; i != levels; ++i) {
+        const auto & previous = ret.empty() ? scene : ret.back();
+        ret.push_back(
+            simplify_scene(previous, previous.triangles.size() * ratio));
+    }
+    return ret;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "scene_data.h"
+
+/// The size of a scene before and after optimization.
+struct SceneOptimizationResults {
+    SceneData::size_type vertices_before;
+    SceneData::size_type vertices_after;
+    SceneData::size_type triangles_before;
+    SceneData::size_type triangles_after;
+};
+
+/// Merge vertices which lie within weld_distance of one another.
+/// Welding is transitive, so a chain of vertices which are each within
+/// weld_distance of the next becomes a single vertex.
+void weld_vertices(SceneData & scene, float weld_distance);
+
+/// Remove triangles which have repeated vertices or an area below min_area,
+/// and exact duplicates of an earlier triangle.
+/// Triangles with the same vertices but opposite winding or a different
+/// surface, such as the two sides of a panel, are kept.
+void remove_degenerate_triangles(SceneData & scene, float min_area);
+
+/// Simplify flat regions of triangles which share a surface.
+/// Vertices in the interior of such a region, or in the middle of a straight
+/// edge of the region, are collapsed into a neighbouring vertex.
+/// The outline of each region and the boundaries between surfaces are
+/// preserved, so the scene looks the same to a ray, but fragmented regions
+/// are described with far fewer triangles.
+/// Two triangles are considered coplanar when the dot product of their
+/// normals is at least 1 - tolerance.
+void merge_coplanar_triangles(SceneData & scene, float tolerance);
+
+/// Remove vertices which are not used by any triangle.
+void remove_unused_vertices(SceneData & scene);
+
+/// Weld vertices, remove degenerate triangles and merge coplanar triangles.
+/// Every triangle costs an intersection test per ray per reflection, so this
+/// can speed up raytracing considerably for models exported from modelling
+/// software, which often contain many small coplanar fragments.
+SceneOptimizationResults optimize_scene(SceneData & scene,
+                                        float weld_distance = 0.0001,
+                                        float tolerance = 0.0001);
+
+/// Reduce a scene to (at most) target_triangles triangles by quadric error
+/// edge collapse.
+/// Vertices on the boundary between two surfaces, or on the open edge of a
+/// mesh, are never moved, so surface regions keep their outlines.
+/// The result may have more than target_triangles triangles if no further
+/// collapses are possible.
+SceneData simplify_scene(const SceneData & scene,
+                         SceneData::size_type target_triangles);
+
+/// Build a chain of increasingly simplified scenes, where each level has
+/// ratio times as many triangles as the level before.
+/// The original scene is not included.
+std::vector<SceneData> build_lod_chain(const SceneData & scene,
+                                       unsigned levels,
+                                       float ratio);
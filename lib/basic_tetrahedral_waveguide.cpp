@@ -0,0 +1,30 @@
+#include "basic_tetrahedral_waveguide.h"
+
+using namespace std;
+
+BasicTetrahedralWaveguide::BasicTetrahedralWaveguide(const Boundary & boundary,
+                                                     float cube_side,
+                                                     bool morton_order)
+        : mesh(boundary, cube_side, morton_order) {
+}
+
+BasicTetrahedralWaveguide::size_type
+BasicTetrahedralWaveguide::get_index_for_coordinate(const Vec3f & v) const {
+    return mesh.get_node_index_for_coordinate(v);
+}
+
+Vec3f BasicTetrahedralWaveguide::get_coordinate_for_index(
+    size_type index) const {
+    return convert(mesh.nodes[index].position);
+}
+
+BasicTetrahedralWaveguide::size_type BasicTetrahedralWaveguide::get_nodes()
+    const {
+    return mesh.nodes.size();
+}
+
+void BasicTetrahedralWaveguide::check_receiver(size_type o) const {
+    if (o >= mesh.nodes.size()) {
+        throw runtime_error("requested output node does not exist");
+    }
+}
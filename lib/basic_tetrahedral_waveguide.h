@@ -0,0 +1,25 @@
+#pragma once
+
+#include "waveguide.h"
+#include "iterative_tetrahedral_mesh.h"
+
+/// The base of the tetrahedral waveguides which keep the whole mesh on the
+/// host and manage their own storage, rather than going through Waveguide.
+class BasicTetrahedralWaveguide : public BasicWaveguide {
+public:
+    BasicTetrahedralWaveguide(const Boundary & boundary,
+                              float cube_side,
+                              bool morton_order = false);
+    virtual ~BasicTetrahedralWaveguide() noexcept = default;
+
+    size_type get_index_for_coordinate(const Vec3f & v) const override;
+    Vec3f get_coordinate_for_index(size_type index) const override;
+
+    size_type get_nodes() const;
+
+protected:
+    /// Throws if o is not a node in the mesh.
+    void check_receiver(size_type o) const;
+
+    IterativeTetrahedralMesh mesh;
+};
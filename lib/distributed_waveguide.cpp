@@ -0,0 +1,224 @@
+#include "distributed_waveguide.h"
+#include "cl_common.h"
+
+#include <iostream>
+
+using namespace std;
+
+namespace {
+cl::Buffer make_storage(const cl::Context & context, size_t nodes) {
+    return cl::Buffer(context,
+                      CL_MEM_READ_WRITE,
+                      sizeof(cl_float) * max(nodes, size_t{1}));
+}
+}  // namespace
+
+DistributedTetrahedralWaveguide::Device::Device(
+    const TetrahedralProgram & program,
+    cl::CommandQueue & queue,
+    const SlabDecomposition::Slab & slab)
+        : queue(queue)
+        , kernel(program.get_kernel())
+        , record_kernel(program.get_record_kernel())
+        , context(program.getInfo<CL_PROGRAM_CONTEXT>())
+        , port_buffer(make_buffer(context, slab.ports))
+        , send_buffer(make_buffer(context, slab.send_list))
+        , rest_buffer(make_buffer(context, slab.rest_list))
+        , storage({{make_storage(context, slab.nodes.size()),
+                    make_storage(context, slab.nodes.size())}}) {
+}
+
+DistributedTetrahedralWaveguide::DistributedTetrahedralWaveguide(
+    const vector<TetrahedralProgram> & programs,
+    vector<cl::CommandQueue> & queues,
+    const Boundary & boundary,
+    float cube_side)
+        : BasicTetrahedralWaveguide(boundary, cube_side)
+        , decomposition(mesh.nodes, programs.size()) {
+    if (programs.size() != queues.size()) {
+        throw runtime_error(
+            "distributed waveguide needs one queue per program");
+    }
+
+    for (auto i = 0u; i != programs.size(); ++i)
+        devices.emplace_back(programs[i], queues[i], decomposition.slabs[i]);
+}
+
+DistributedTetrahedralWaveguide::size_type
+DistributedTetrahedralWaveguide::get_devices() const {
+    return devices.size();
+}
+
+vector<vector<cl_float>> DistributedTetrahedralWaveguide::run(
+    size_type source, const vector<size_type> & receivers, size_type steps) {
+    check_receiver(source);
+    for (auto i : receivers)
+        check_receiver(i);
+
+    Logger::log("beginning distributed simulation with: ",
+                mesh.nodes.size(),
+                " nodes on ",
+                devices.size(),
+                " devices and ",
+                receivers.size(),
+                " receivers");
+
+    const auto & slabs = decomposition.slabs;
+    auto chunk = max(size_type{1}, min(steps, get_steps_per_sync()));
+
+    //  the receivers owned by each slab, as indices into receivers and as
+    //  local indices
+    vector<vector<size_type>> slab_receivers(devices.size());
+    vector<cl::Buffer> receiver_buffers(devices.size());
+    vector<cl::Buffer> outputs(devices.size());
+    for (auto r = 0u; r != receivers.size(); ++r)
+        slab_receivers[decomposition.get_slab(receivers[r])].push_back(r);
+
+    vector<vector<cl_float>> sent(devices.size());
+    vector<vector<cl_float>> halo(devices.size());
+    vector<vector<cl_float>> out(devices.size());
+    vector<cl::Event> reads(devices.size());
+
+    for (auto d = 0u; d != devices.size(); ++d) {
+        auto & device = devices[d];
+        const auto & slab = slabs[d];
+
+        //  halo copies of the source start with the impulse too
+        vector<cl_float> n(max(slab.nodes.size(), size_t{1}), 0);
+        cl::copy(device.queue, n.begin(), n.end(), device.storage[0]);
+        for (auto j = 0u; j != slab.nodes.size(); ++j)
+            n[j] = slab.nodes[j] == source ? 1 : 0;
+        cl::copy(device.queue, n.begin(), n.end(), device.storage[1]);
+
+        sent[d].resize(slab.send);
+        halo[d].resize(slab.get_halo());
+
+        if (!slab_receivers[d].empty()) {
+            vector<cl_ulong> indices;
+            for (auto r : slab_receivers[d])
+                indices.push_back(decomposition.get_local_index(receivers[r]));
+            receiver_buffers[d] = make_buffer(device.context, indices);
+            outputs[d] = cl::Buffer(
+                device.context,
+                CL_MEM_READ_WRITE,
+                sizeof(cl_float) * chunk * slab_receivers[d].size());
+            out[d].resize(chunk * slab_receivers[d].size());
+        }
+    }
+
+    vector<vector<cl_float>> ret(receivers.size(), vector<cl_float>(steps));
+    auto previous = 0u;
+    auto current = 1u;
+
+    for (size_type begin = 0; begin < steps; begin += chunk) {
+        auto end = min(steps, begin + chunk);
+        for (auto i = begin; i != end; ++i) {
+            for (auto d = 0u; d != devices.size(); ++d) {
+                auto & device = devices[d];
+                const auto & slab = slabs[d];
+                auto & p = device.storage[previous];
+                auto & c = device.storage[current];
+
+                if (!slab.send_list.empty()) {
+                    device.kernel(cl::EnqueueArgs(
+                                      device.queue,
+                                      cl::NDRange(slab.send_list.size())),
+                                  c,
+                                  p,
+                                  device.port_buffer,
+                                  device.send_buffer);
+                }
+
+                if (slab.send) {
+                    device.queue.enqueueReadBuffer(p,
+                                                   CL_FALSE,
+                                                   0,
+                                                   sizeof(cl_float) * slab.send,
+                                                   sent[d].data(),
+                                                   nullptr,
+                                                   &reads[d]);
+                }
+
+                if (!slab.rest_list.empty()) {
+                    device.kernel(cl::EnqueueArgs(
+                                      device.queue,
+                                      cl::NDRange(slab.rest_list.size())),
+                                  c,
+                                  p,
+                                  device.port_buffer,
+                                  device.rest_buffer);
+                }
+
+                auto width = slab_receivers[d].size();
+                if (width) {
+                    device.record_kernel(
+                        cl::EnqueueArgs(device.queue, cl::NDRange(width)),
+                        p,
+                        receiver_buffers[d],
+                        outputs[d],
+                        (i - begin) * width);
+                }
+
+                device.queue.flush();
+            }
+
+            //  only halo values are waited for here, so the devices carry
+            //  on with their remaining nodes during the exchange
+            for (auto d = 0u; d != devices.size(); ++d) {
+                if (slabs[d].send)
+                    reads[d].wait();
+            }
+
+            //  the writes are queued behind each device's remaining nodes,
+            //  and the next step's halo read is queued behind the write, so
+            //  halo[d] is free again once reads[d] has been waited on
+            decomposition.exchange(sent, halo);
+            for (auto d = 0u; d != devices.size(); ++d) {
+                const auto & slab = slabs[d];
+                if (!slab.get_halo())
+                    continue;
+                devices[d].queue.enqueueWriteBuffer(
+                    devices[d].storage[previous],
+                    CL_FALSE,
+                    sizeof(cl_float) * slab.get_owned(),
+                    sizeof(cl_float) * halo[d].size(),
+                    halo[d].data());
+            }
+
+            swap(previous, current);
+        }
+
+        auto rows = end - begin;
+        for (auto d = 0u; d != devices.size(); ++d) {
+            auto width = slab_receivers[d].size();
+            if (!width)
+                continue;
+            cl::copy(devices[d].queue,
+                     outputs[d],
+                     out[d].begin(),
+                     out[d].begin() + rows * width);
+            for (auto i = begin; i != end; ++i) {
+                for (auto j = 0u; j != width; ++j) {
+                    ret[slab_receivers[d][j]][i] =
+                        out[d][(i - begin) * width + j];
+                }
+            }
+        }
+
+        print_progress(end, steps);
+    }
+
+    std::cout << std::endl;
+
+    //  the halo writes read from halo, which is about to go out of scope
+    for (auto & device : devices)
+        device.queue.finish();
+
+    return ret;
+}
+
+vector<cl_float> DistributedTetrahedralWaveguide::run_basic(const Vec3f & e,
+                                                            size_type o,
+                                                            size_type steps) {
+    return run(get_index_for_coordinate(e), {o}, steps).front();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "basic_tetrahedral_waveguide.h"
+#include "slab_decomposition.h"
+
+/// A tetrahedral waveguide split across several OpenCL devices, so that the
+/// mesh can be larger than the memory of any one device, and each step is
+/// shared between all of them.
+/// The mesh is split into one slab per device (see SlabDecomposition).
+/// Every step, each device updates the nodes its neighbours read, starts
+/// reading them back, and then updates the rest of its nodes.
+/// While those updates run, the host copies the values it read into the
+/// halos of the other devices, so the exchange is mostly hidden.
+/// The devices can be separate devices, or sub-devices of one device made
+/// with clCreateSubDevices.
+class DistributedTetrahedralWaveguide : public BasicTetrahedralWaveguide {
+public:
+    /// Slab i runs on the device which built programs[i] and owns
+    /// queues[i].
+    DistributedTetrahedralWaveguide(
+        const std::vector<TetrahedralProgram> & programs,
+        std::vector<cl::CommandQueue> & queues,
+        const Boundary & boundary,
+        float cube_side);
+    virtual ~DistributedTetrahedralWaveguide() noexcept = default;
+
+    /// Run with an impulse at node source, recording every node in
+    /// receivers at every step.
+    /// Returns one signal per receiver.
+    std::vector<std::vector<cl_float>> run(
+        size_type source,
+        const std::vector<size_type> & receivers,
+        size_type steps);
+
+    std::vector<cl_float> run_basic(const Vec3f & e,
+                                    size_type o,
+                                    size_type steps) override;
+
+    size_type get_devices() const;
+
+private:
+    using kernel_type =
+        decltype(std::declval<TetrahedralProgram>().get_kernel());
+    using record_kernel_type =
+        decltype(std::declval<TetrahedralProgram>().get_record_kernel());
+
+    /// The state for one slab on its device.
+    struct Device {
+        Device(const TetrahedralProgram & program,
+               cl::CommandQueue & queue,
+               const SlabDecomposition::Slab & slab);
+
+        cl::CommandQueue queue;
+        kernel_type kernel;
+        record_kernel_type record_kernel;
+        cl::Context context;
+        cl::Buffer port_buffer;
+        cl::Buffer send_buffer;
+        cl::Buffer rest_buffer;
+        std::array<cl::Buffer, 2> storage;
+    };
+
+
+    SlabDecomposition decomposition;
+    std::vector<Device> devices;
+};
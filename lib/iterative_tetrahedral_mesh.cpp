@@ -59,12 +59,132 @@ vector<Node> IterativeTetrahedralMesh::get_nodes(
 }
 
 IterativeTetrahedralMesh::IterativeTetrahedralMesh(const Boundary & boundary,
-                                                   float spacing)
+                                                   float spacing,
+                                                   bool morton_order)
         : boundary(boundary.get_aabb())
         , cube_side(cube_side_from_node_spacing(spacing))
         , scaled_cube(get_scaled_cube())
         , dim(get_dim())
         , nodes(get_nodes(boundary)) {
+    compact(morton_order);
+}
+
+cl_ulong IterativeTetrahedralMesh::morton_code(const Locator & locator) {
+    //  interleave 20 bits of each coordinate, with the node within the cube
+    //  in the lowest bits
+    auto spread = [](cl_ulong i) {
+        cl_ulong ret = 0;
+        for (auto bit = 0u; bit != 20; ++bit)
+            ret |= ((i >> bit) & 1) << (bit * 3);
+        return ret;
+    };
+    const auto & p = locator.pos;
+    auto code = spread(p.x) | (spread(p.y) << 1) | (spread(p.z) << 2);
+    return (code << 3) | locator.mod_ind;
+}
+
+void IterativeTetrahedralMesh::compact(bool morton_order) {
+    //  keep only the nodes inside the boundary, so that the waveguide is sized
+    //  by the volume of the room rather than its bounding box
+    //  every stored node is inside from here on, and ports to nodes outside
+    //  are -1, so users of nodes don't need to check inside
+    vector<size_type> kept;
+    for (auto i = 0u; i != nodes.size(); ++i) {
+        if (nodes[i].inside)
+            kept.push_back(i);
+    }
+
+    if (morton_order) {
+        vector<cl_ulong> codes(nodes.size());
+        for (auto i : kept)
+            codes[i] = morton_code(get_locator(i));
+        sort(kept.begin(), kept.end(), [&codes](auto a, auto b) {
+            return codes[a] < codes[b];
+        });
+    }
+
+    index_map = vector<int>(nodes.size(), -1);
+    vector<Node> inside;
+    for (auto i : kept) {
+        index_map[i] = inside.size();
+        inside.push_back(nodes[i]);
+    }
+
+    for (auto & node : inside) {
+        for (auto & port : node.ports) {
+            port = port < 0 ? -1 : index_map[port];
+        }
+    }
+
+    Logger::log("kept ",
+                inside.size(),
+                " of ",
+                nodes.size(),
+                " waveguide nodes inside the boundary");
+    nodes = inside;
+}
+
+int IterativeTetrahedralMesh::get_node_index(const Locator & locator) const {
+    auto in_grid = (Vec3i(0) <= locator.pos && locator.pos < dim).all();
+    return in_grid ? index_map[get_index(locator)] : -1;
+}
+
+IterativeTetrahedralMesh::size_type
+IterativeTetrahedralMesh::get_node_index_for_coordinate(
+    const Vec3f & position) const {
+    auto index = get_node_index(get_locator(position));
+    if (index < 0)
+        throw runtime_error("requested coordinate is outside boundary");
+    return index;
+}
+
+IterativeTetrahedralMesh::Tile IterativeTetrahedralMesh::get_tile(
+    size_type begin,
+    size_type end,
+    unsigned depth,
+    vector<int> & local) const {
+    Tile ret;
+    ret.begin = begin;
+    ret.end = end;
+
+    //  the tile's own nodes come first, in order, followed by the halo one
+    //  layer at a time
+    for (auto i = begin; i != end; ++i) {
+        local[i] = ret.nodes.size();
+        ret.nodes.push_back(i);
+    }
+    ret.within.push_back(ret.nodes.size());
+
+    auto layer_begin = 0u;
+    for (auto distance = 1u; distance <= depth; ++distance) {
+        auto layer_end = ret.nodes.size();
+        for (auto i = layer_begin; i != layer_end; ++i) {
+            for (auto port : nodes[ret.nodes[i]].ports) {
+                if (port >= 0 && local[port] < 0) {
+                    local[port] = ret.nodes.size();
+                    ret.nodes.push_back(port);
+                }
+            }
+        }
+        layer_begin = layer_end;
+        ret.within.push_back(ret.nodes.size());
+    }
+
+    //  ports leaving the halo are only found on its outermost layer, which
+    //  is never updated
+    ret.ports.resize(ret.nodes.size());
+    for (auto i = 0u; i != ret.nodes.size(); ++i) {
+        for (auto j = 0; j != PORTS; ++j) {
+            auto port = nodes[ret.nodes[i]].ports[j];
+            ret.ports[i].s[j] = port < 0 ? -1 : local[port];
+        }
+    }
+
+    //  leave local ready for the next tile
+    for (auto i : ret.nodes)
+        local[i] = -1;
+
+    return ret;
 }
 
 IterativeTetrahedralMesh::size_type IterativeTetrahedralMesh::get_index(
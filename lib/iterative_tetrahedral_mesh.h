@@ -19,21 +19,83 @@ public:
     static const int PORTS = 4;
     static const int CUBE_NODES = 8;
 
-    IterativeTetrahedralMesh(const Boundary & boundary, float spacing);
+    /// A contiguous range of stored nodes along with a halo of all the nodes
+    /// within some number of connections of it.
+    /// A tile can be advanced by as many steps as its halo is deep without
+    /// reading anything outside it.
+    struct Tile {
+        size_type begin;
+        size_type end;
+        /// The index in nodes of each local node.
+        /// The tile's own nodes come first, in order, then the halo in
+        /// layers.
+        std::vector<size_type> nodes;
+        /// within[d] is the number of local nodes at most d connections from
+        /// the tile.
+        std::vector<size_type> within;
+        /// Ports as local indices.
+        std::vector<cl_int4> ports;
+
+        /// Calls f(valid, step) for each of length steps, where the first
+        /// valid local nodes are the ones which can be updated on that step.
+        /// After each step, the nodes on the outermost valid layer have out
+        /// of date neighbours, so the valid region shrinks by one layer.
+        /// length must be no more than the depth of the halo.
+        template <typename Fun>
+        void step(size_type length, const Fun & f) const {
+            auto depth = within.size() - 1;
+            for (size_type i = 0; i != length; ++i)
+                f(within[depth - i - 1], i);
+        }
+    };
+
+    /// If morton_order is true, the stored nodes are sorted along a Morton
+    /// curve through the grid, so that nodes which are close in space are
+    /// also close in memory.
+    /// Otherwise they are stored in grid order, where the neighbours of a node
+    /// in y and z are a whole row or layer apart.
+    IterativeTetrahedralMesh(const Boundary & boundary,
+                             float spacing,
+                             bool morton_order = false);
     virtual ~IterativeTetrahedralMesh() noexcept = default;
 
+    /// get_index, get_locator(size_type) and get_neighbors work with indices
+    /// into the full grid of nodes covering the bounding box.
+    /// Only nodes inside the boundary are stored, so use get_node_index to
+    /// find the index of a node in the nodes vector.
     size_type get_index(const Locator & locator) const;
     Locator get_locator(size_type index) const;
     Locator get_locator(const Vec3f & position) const;
     Vec3f get_position(const Locator & locator) const;
     std::array<int, PORTS> get_neighbors(size_type index) const;
 
+    /// Returns the index in nodes of the node at locator, or -1 if there is no
+    /// such node inside the boundary.
+    int get_node_index(const Locator & locator) const;
+
+    /// Returns the index in nodes of the node closest to position, throwing
+    /// if that node is outside the boundary.
+    size_type get_node_index_for_coordinate(const Vec3f & position) const;
+
+    /// Returns the tile made of nodes [begin, end) with a halo depth layers
+    /// deep.
+    /// local maps indices in nodes to local indices, and must be all -1.
+    /// It is left all -1 again so that it can be reused for the next tile.
+    Tile get_tile(size_type begin,
+                  size_type end,
+                  unsigned depth,
+                  std::vector<int> & local) const;
+
     const CuboidBoundary boundary;
     const float cube_side;
     const std::vector<Vec3f> scaled_cube;
     const Vec3i dim;
     std::vector<Node> nodes;
 
+    /// Maps full-grid indices to indices in nodes, or -1 for nodes outside
+    /// the boundary.
+    std::vector<int> index_map;
+
     static float cube_side_from_node_spacing(float spacing);
 
 private:
@@ -42,5 +104,7 @@ private:
 
     Vec3i get_dim() const;
     std::vector<Node> get_nodes(const Boundary & boundary) const;
+    void compact(bool morton_order);
+    static cl_ulong morton_code(const Locator & locator);
     std::vector<Vec3f> get_scaled_cube() const;
 };
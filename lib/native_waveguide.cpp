@@ -0,0 +1,344 @@
+#include "native_waveguide.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+class Barrier {
+public:
+    explicit Barrier(size_t count)
+            : count(count) {
+    }
+
+    void wait() {
+        unique_lock<mutex> lock(m);
+        auto current = generation;
+        if (++waiting == count) {
+            waiting = 0;
+            generation += 1;
+            cv.notify_all();
+        } else {
+            cv.wait(lock, [this, current] { return current != generation; });
+        }
+    }
+
+private:
+    mutex m;
+    condition_variable cv;
+    const size_t count;
+    size_t waiting{0};
+    size_t generation{0};
+};
+
+/// Update node i, reading current and writing previous.
+void step_node(const cl_int4 * ports,
+               const cl_float * current,
+               cl_float * previous,
+               size_t i) {
+    cl_float temp = 0;
+    for (auto port : ports[i].s) {
+        if (port >= 0)
+            temp += current[port];
+    }
+    temp /= 2;
+    temp -= previous[i];
+    previous[i] = temp;
+}
+
+#ifdef __SSE2__
+/// True if every port of the four nodes starting at ports is valid.
+bool all_valid(const cl_int4 * ports) {
+    //  invalid ports are negative, so or-ing everything together leaves a
+    //  sign bit set if any port is invalid
+    auto p = reinterpret_cast<const __m128i *>(ports);
+    auto any = _mm_or_si128(
+        _mm_or_si128(_mm_loadu_si128(p + 0), _mm_loadu_si128(p + 1)),
+        _mm_or_si128(_mm_loadu_si128(p + 2), _mm_loadu_si128(p + 3)));
+    return _mm_movemask_ps(_mm_castsi128_ps(any)) == 0;
+}
+
+/// Update nodes [begin, end), reading current and writing previous, with
+/// the additions in the same order as the waveguide kernel.
+/// Runs of four nodes with no invalid ports are updated together.
+void step_range(const cl_int4 * ports,
+                const cl_float * current,
+                cl_float * previous,
+                size_t begin,
+                size_t end) {
+    auto i = begin;
+    while (i != end) {
+        if (i + 4 <= end && all_valid(ports + i)) {
+            auto port = [&](auto j) {
+                return _mm_set_ps(current[ports[i + 3].s[j]],
+                                  current[ports[i + 2].s[j]],
+                                  current[ports[i + 1].s[j]],
+                                  current[ports[i + 0].s[j]]);
+            };
+
+            auto temp = _mm_add_ps(port(0), port(1));
+            temp = _mm_add_ps(temp, port(2));
+            temp = _mm_add_ps(temp, port(3));
+            temp = _mm_mul_ps(temp, _mm_set1_ps(0.5f));
+            temp = _mm_sub_ps(temp, _mm_loadu_ps(previous + i));
+            _mm_storeu_ps(previous + i, temp);
+            i += 4;
+        } else {
+            step_node(ports, current, previous, i);
+            i += 1;
+        }
+    }
+}
+#else
+/// Update nodes [begin, end), reading current and writing previous, with
+/// the additions in the same order as the waveguide kernel.
+void step_range(const cl_int4 * ports,
+                const cl_float * current,
+                cl_float * previous,
+                size_t begin,
+                size_t end) {
+    for (auto i = begin; i != end; ++i)
+        step_node(ports, current, previous, i);
+}
+#endif
+}  // namespace
+
+const NativeTetrahedralWaveguide::size_type
+    NativeTetrahedralWaveguide::TILE_NODES;
+
+NativeTetrahedralWaveguide::NativeTetrahedralWaveguide(
+    const Boundary & boundary,
+    float spacing,
+    unsigned threads,
+    unsigned blocking_factor)
+        : BasicTetrahedralWaveguide(boundary, spacing, blocking_factor > 1)
+        , threads(threads ? threads : max(1u, thread::hardware_concurrency()))
+        , blocking_factor(max(1u, blocking_factor))
+        , tiles(get_tiles()) {
+}
+
+vector<IterativeTetrahedralMesh::Tile> NativeTetrahedralWaveguide::get_tiles()
+    const {
+    vector<IterativeTetrahedralMesh::Tile> ret;
+    if (blocking_factor == 1)
+        return ret;
+
+    auto nodes = get_nodes();
+    vector<int> local(nodes, -1);
+    for (size_type begin = 0; begin < nodes; begin += TILE_NODES) {
+        ret.push_back(mesh.get_tile(
+            begin, min(nodes, begin + TILE_NODES), blocking_factor, local));
+    }
+    return ret;
+}
+
+unsigned NativeTetrahedralWaveguide::get_threads() const {
+    return threads;
+}
+
+vector<vector<cl_float>> NativeTetrahedralWaveguide::run(
+    size_type source, const vector<size_type> & receivers, size_type steps) {
+    check_receiver(source);
+    for (auto i : receivers)
+        check_receiver(i);
+
+    auto nodes = get_nodes();
+    Logger::log("beginning native simulation with: ",
+                nodes,
+                " nodes, ",
+                receivers.size(),
+                " receivers, ",
+                threads,
+                " threads and blocking factor ",
+                blocking_factor);
+
+    vector<vector<cl_float>> ret(receivers.size(), vector<cl_float>(steps));
+
+    auto start = chrono::steady_clock::now();
+
+    if (blocking_factor > 1)
+        run_blocked(source, receivers, steps, ret);
+    else
+        run_stepwise(source, receivers, steps, ret);
+
+    auto seconds = chrono::duration<double>(chrono::steady_clock::now() -
+                                            start).count();
+    Logger::log("native simulation took: ",
+                seconds,
+                " s, ",
+                nodes * steps / seconds / threads,
+                " node updates per second per thread");
+
+    return ret;
+}
+
+void NativeTetrahedralWaveguide::run_stepwise(
+    size_type source,
+    const vector<size_type> & receivers,
+    size_type steps,
+    vector<vector<cl_float>> & ret) const {
+    auto nodes = get_nodes();
+
+    //  not initialised here, so that each page is first touched by the
+    //  thread that updates it
+    unique_ptr<cl_int4[]> ports(new cl_int4[nodes]);
+    unique_ptr<cl_float[]> a(new cl_float[nodes]);
+    unique_ptr<cl_float[]> b(new cl_float[nodes]);
+
+    //  ranges are multiples of 16 nodes, so that threads don't share cache
+    //  lines
+    auto per_thread = (nodes + threads - 1) / threads;
+    per_thread = (per_thread + 15) / 16 * 16;
+
+    Barrier barrier(threads);
+
+    auto worker = [&](unsigned t) {
+        auto begin = min(nodes, t * per_thread);
+        auto end = min(nodes, begin + per_thread);
+
+        for (auto i = begin; i != end; ++i) {
+            for (auto j = 0; j != IterativeTetrahedralMesh::PORTS; ++j)
+                ports[i].s[j] = mesh.nodes[i].ports[j];
+            a[i] = 0;
+            b[i] = i == source ? 1 : 0;
+        }
+
+        cl_float * previous = a.get();
+        cl_float * current = b.get();
+
+        barrier.wait();
+
+        for (auto step = 0u; step != steps; ++step) {
+            step_range(ports.get(), current, previous, begin, end);
+            swap(current, previous);
+            barrier.wait();
+
+            //  current won't be written again until the step after next, so
+            //  it's safe to read while the other threads carry on
+            if (t == 0) {
+                for (auto r = 0u; r != receivers.size(); ++r)
+                    ret[r][step] = current[receivers[r]];
+            }
+        }
+    };
+
+    vector<thread> workers;
+    for (auto t = 1u; t < threads; ++t)
+        workers.emplace_back(worker, t);
+    worker(0);
+    for (auto & i : workers)
+        i.join();
+}
+
+void NativeTetrahedralWaveguide::run_blocked(
+    size_type source,
+    const vector<size_type> & receivers,
+    size_type steps,
+    vector<vector<cl_float>> & ret) const {
+    auto nodes = get_nodes();
+    auto num_tiles = tiles.size();
+    auto tiles_per_thread = (num_tiles + threads - 1) / threads;
+
+    //  the state before and after each block of steps, as (current,
+    //  previous) pairs, because other tiles still need the old values for
+    //  their halos while a block is being computed
+    unique_ptr<cl_float[]> in_current(new cl_float[nodes]);
+    unique_ptr<cl_float[]> in_previous(new cl_float[nodes]);
+    unique_ptr<cl_float[]> out_current(new cl_float[nodes]);
+    unique_ptr<cl_float[]> out_previous(new cl_float[nodes]);
+
+    Barrier barrier(threads);
+
+    auto worker = [&](unsigned t) {
+        auto first_tile = min(num_tiles, t * tiles_per_thread);
+        auto last_tile = min(num_tiles, first_tile + tiles_per_thread);
+
+        auto max_local = size_type{0};
+        for (auto j = first_tile; j != last_tile; ++j) {
+            const auto & tile = tiles[j];
+            max_local = max(max_local, tile.nodes.size());
+            for (auto i = tile.begin; i != tile.end; ++i) {
+                in_current[i] = out_current[i] = i == source ? 1 : 0;
+                in_previous[i] = out_previous[i] = 0;
+            }
+        }
+
+        //  receivers in this thread's tiles, as (receiver, tile, local index)
+        vector<array<size_type, 3>> local_receivers;
+        for (auto r = 0u; r != receivers.size(); ++r) {
+            auto tile = receivers[r] / TILE_NODES;
+            if (first_tile <= tile && tile < last_tile) {
+                local_receivers.push_back(
+                    {{r, tile, receivers[r] % TILE_NODES}});
+            }
+        }
+
+        vector<cl_float> a(max_local), b(max_local);
+
+        auto current = in_current.get();
+        auto previous = in_previous.get();
+        auto next_current = out_current.get();
+        auto next_previous = out_previous.get();
+
+        barrier.wait();
+
+        for (auto block = 0u; block < steps; block += blocking_factor) {
+            auto length = min<size_type>(blocking_factor, steps - block);
+
+            for (auto i = first_tile; i != last_tile; ++i) {
+                const auto & tile = tiles[i];
+                auto local_current = a.data();
+                auto local_previous = b.data();
+                for (auto j = 0u; j != tile.nodes.size(); ++j) {
+                    local_current[j] = current[tile.nodes[j]];
+                    local_previous[j] = previous[tile.nodes[j]];
+                }
+
+                tile.step(length, [&](auto valid, auto step) {
+                    step_range(tile.ports.data(),
+                               local_current,
+                               local_previous,
+                               0,
+                               valid);
+                    swap(local_current, local_previous);
+
+                    for (const auto & r : local_receivers) {
+                        if (r[1] == i)
+                            ret[r[0]][block + step] = local_current[r[2]];
+                    }
+                });
+
+                for (auto j = tile.begin; j != tile.end; ++j) {
+                    next_current[j] = local_current[j - tile.begin];
+                    next_previous[j] = local_previous[j - tile.begin];
+                }
+            }
+
+            swap(current, next_current);
+            swap(previous, next_previous);
+            barrier.wait();
+        }
+    };
+
+    vector<thread> workers;
+    for (auto t = 1u; t < threads; ++t)
+        workers.emplace_back(worker, t);
+    worker(0);
+    for (auto & i : workers)
+        i.join();
+}
+
+vector<cl_float> NativeTetrahedralWaveguide::run_basic(const Vec3f & e,
+                                                       size_type o,
+                                                       size_type steps) {
+    return run(get_index_for_coordinate(e), {o}, steps).front();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "basic_tetrahedral_waveguide.h"
+
+#include <memory>
+
+/// A tetrahedral waveguide which runs on the host rather than through
+/// OpenCL, for machines without a suitable device.
+/// Nodes are split into contiguous ranges, one per thread, and each thread
+/// allocates its own part of the node arrays by touching it first, so that
+/// on NUMA machines the memory ends up local to the thread which uses it.
+/// Runs of four nodes whose ports are all valid are updated with SSE.
+/// The arithmetic is done in the same order as the OpenCL waveguide kernel.
+///
+/// With a blocking factor above 1, the mesh is stored in Morton order and
+/// split into tiles of contiguous nodes, which are compact in space.
+/// Each tile is copied into a small buffer along with a halo of all the
+/// nodes within blocking_factor connections of it, then advanced by
+/// blocking_factor steps while it stays in cache, and the tile is written
+/// back.
+/// The halo nodes are updated redundantly by neighbouring tiles, but main
+/// memory is only swept once per blocking_factor steps.
+class NativeTetrahedralWaveguide : public BasicTetrahedralWaveguide {
+public:
+    /// The number of nodes in each tile when temporal blocking is used.
+    static const size_type TILE_NODES = 4096;
+
+    /// If threads is 0, one thread per hardware thread is used.
+    NativeTetrahedralWaveguide(const Boundary & boundary,
+                               float spacing,
+                               unsigned threads = 0,
+                               unsigned blocking_factor = 1);
+    virtual ~NativeTetrahedralWaveguide() noexcept = default;
+
+    /// Run with an impulse at node source, recording every node in
+    /// receivers at every step.
+    /// Returns one signal per receiver.
+    std::vector<std::vector<cl_float>> run(
+        size_type source,
+        const std::vector<size_type> & receivers,
+        size_type steps);
+
+    std::vector<cl_float> run_basic(const Vec3f & e,
+                                    size_type o,
+                                    size_type steps) override;
+
+    unsigned get_threads() const;
+
+private:
+    void run_stepwise(size_type source,
+                      const std::vector<size_type> & receivers,
+                      size_type steps,
+                      std::vector<std::vector<cl_float>> & ret) const;
+    void run_blocked(size_type source,
+                     const std::vector<size_type> & receivers,
+                     size_type steps,
+                     std::vector<std::vector<cl_float>> & ret) const;
+
+    /// The tiles used with temporal blocking, or none without it.
+    std::vector<IterativeTetrahedralMesh::Tile> get_tiles() const;
+
+    unsigned threads;
+    unsigned blocking_factor;
+    std::vector<IterativeTetrahedralMesh::Tile> tiles;
+};
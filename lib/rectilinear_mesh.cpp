@@ -0,0 +1,61 @@
+#include "rectilinear_mesh.h"
+
+#include "logger.h"
+
+#include <cmath>
+
+using namespace std;
+
+RectilinearMesh::RectilinearMesh(const Boundary & boundary, float spacing)
+        : boundary(boundary.get_aabb())
+        , spacing(spacing)
+        , dim(get_dim())
+        , inside_mask(get_inside_mask(boundary)) {
+}
+
+Vec3i RectilinearMesh::get_dim() const {
+    auto dimensions = boundary.get_dimensions();
+    return (dimensions / spacing).map([](auto i) { return ceil(i); }) + 1;
+}
+
+vector<cl_uint> RectilinearMesh::get_inside_mask(
+    const Boundary & boundary) const {
+    vector<cl_uint> ret((get_nodes() + 31) / 32, 0);
+    auto count = 0u;
+    for (auto i = 0u; i != get_nodes(); ++i) {
+        if (boundary.inside(get_position(get_locator(i)))) {
+            ret[i / 32] |= 1u << (i % 32);
+            count += 1;
+        }
+    }
+    Logger::log(count, " of ", get_nodes(), " rectilinear nodes are inside");
+    return ret;
+}
+
+RectilinearMesh::size_type RectilinearMesh::get_index(
+    const Vec3i & locator) const {
+    return locator.x + locator.y * dim.x + locator.z * dim.x * dim.y;
+}
+
+Vec3i RectilinearMesh::get_locator(size_type index) const {
+    auto x = div(static_cast<int>(index), dim.x);
+    auto y = div(x.quot, dim.y);
+    return Vec3i(x.rem, y.rem, y.quot);
+}
+
+Vec3i RectilinearMesh::get_locator(const Vec3f & position) const {
+    auto transformed = (position - boundary.c0) / spacing;
+    return transformed.map([](auto i) -> int { return round(i); });
+}
+
+Vec3f RectilinearMesh::get_position(const Vec3i & locator) const {
+    return boundary.c0 + locator * spacing;
+}
+
+RectilinearMesh::size_type RectilinearMesh::get_nodes() const {
+    return dim.product();
+}
+
+bool RectilinearMesh::inside(size_type index) const {
+    return inside_mask[index / 32] & (1u << (index % 32));
+}
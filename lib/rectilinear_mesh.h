@@ -0,0 +1,39 @@
+#pragma once
+
+#include "vec.h"
+#include "cl_structs.h"
+#include "boundaries.h"
+
+#include <vector>
+
+/// A regular cubic grid of nodes covering the bounding box of a boundary.
+/// Each node is connected to the six nodes next to it along the axes, so
+/// neighbours are found from the index alone and nothing but the inside
+/// flags needs to be stored.
+class RectilinearMesh {
+public:
+    using size_type = std::vector<cl_float>::size_type;
+
+    static const int PORTS = 6;
+
+    RectilinearMesh(const Boundary & boundary, float spacing);
+
+    size_type get_index(const Vec3i & locator) const;
+    Vec3i get_locator(size_type index) const;
+    Vec3i get_locator(const Vec3f & position) const;
+    Vec3f get_position(const Vec3i & locator) const;
+
+    size_type get_nodes() const;
+    bool inside(size_type index) const;
+
+    const CuboidBoundary boundary;
+    const float spacing;
+    const Vec3i dim;
+
+    /// One bit per node, set if the node is inside the boundary.
+    const std::vector<cl_uint> inside_mask;
+
+private:
+    Vec3i get_dim() const;
+    std::vector<cl_uint> get_inside_mask(const Boundary & boundary) const;
+};
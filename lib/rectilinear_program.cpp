@@ -0,0 +1,103 @@
+#include "rectilinear_program.h"
+#include "waveguide_kernels.h"
+
+using namespace std;
+
+RectilinearProgram::RectilinearProgram(const cl::Context & context,
+                                       bool build_immediate)
+        : Program(context, source, build_immediate) {
+}
+
+const string RectilinearProgram::source{
+    waveguide_kernel_source +
+#ifdef DIAGNOSTIC
+    "#define DIAGNOSTIC\n"
+#endif
+    R"(
+    float neighbor(global float * current,
+                   global uint * inside,
+                   bool in_grid,
+                   size_t index) {
+        return in_grid && is_inside(inside, index) ? current[index] : 0;
+    }
+
+    //  Standard rectilinear scheme at the Courant limit of 1 / sqrt(3), where
+    //  the new value is a third of the sum of the six axial neighbours, minus
+    //  the previous value.
+    //  Nodes are stored x-major, and dim is the size of the grid.
+    kernel void waveguide
+    (   global float * current
+    ,   global float * previous
+    ,   global uint * inside
+    ,   int4 dim
+    ) {
+        size_t index = get_global_id(0);
+
+        if (! is_inside(inside, index)) {
+            return;
+        }
+
+        int x = index % dim.x;
+        int y = (index / dim.x) % dim.y;
+        int z = index / (dim.x * dim.y);
+
+        size_t dy = dim.x;
+        size_t dz = dim.x * dim.y;
+
+        float temp =
+            neighbor(current, inside, x > 0, index - 1) +
+            neighbor(current, inside, x < dim.x - 1, index + 1) +
+            neighbor(current, inside, y > 0, index - dy) +
+            neighbor(current, inside, y < dim.y - 1, index + dy) +
+            neighbor(current, inside, z > 0, index - dz) +
+            neighbor(current, inside, z < dim.z - 1, index + dz);
+
+        temp /= 3;
+        temp -= previous[index];
+
+        previous[index] = temp;
+    }
+
+    float neighbor_half(global half * current,
+                        global uint * inside,
+                        bool in_grid,
+                        size_t index) {
+        return in_grid && is_inside(inside, index) ? vload_half(index, current)
+                                                   : 0;
+    }
+
+    //  Like waveguide, but the fields are stored as half precision to halve
+    //  their memory traffic, and the arithmetic is still done in float.
+    kernel void waveguide_half
+    (   global half * current
+    ,   global half * previous
+    ,   global uint * inside
+    ,   int4 dim
+    ) {
+        size_t index = get_global_id(0);
+
+        if (! is_inside(inside, index)) {
+            return;
+        }
+
+        int x = index % dim.x;
+        int y = (index / dim.x) % dim.y;
+        int z = index / (dim.x * dim.y);
+
+        size_t dy = dim.x;
+        size_t dz = dim.x * dim.y;
+
+        float temp =
+            neighbor_half(current, inside, x > 0, index - 1) +
+            neighbor_half(current, inside, x < dim.x - 1, index + 1) +
+            neighbor_half(current, inside, y > 0, index - dy) +
+            neighbor_half(current, inside, y < dim.y - 1, index + dy) +
+            neighbor_half(current, inside, z > 0, index - dz) +
+            neighbor_half(current, inside, z < dim.z - 1, index + dz);
+
+        temp /= 3;
+        temp -= vload_half(index, previous);
+
+        vstore_half(temp, index, previous);
+    }
+    )"};
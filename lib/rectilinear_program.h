@@ -0,0 +1,52 @@
+#pragma once
+
+#define __CL_ENABLE_EXCEPTIONS
+#include "cl.hpp"
+
+class RectilinearProgram : public cl::Program {
+public:
+    RectilinearProgram(const cl::Context & context,
+                       bool build_immediate = false);
+
+    auto get_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_int4>(
+            *this, "waveguide");
+    }
+
+    auto get_half_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_int4>(
+            *this, "waveguide_half");
+    }
+
+    auto get_record_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_ulong>(
+            *this, "record_receivers");
+    }
+
+    auto get_multi_record_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_ulong>(
+            *this, "record_receivers_multi");
+    }
+
+    auto get_record_half_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_ulong>(
+            *this, "record_receivers_half");
+    }
+
+    auto get_energy_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl_ulong,
+                               cl::LocalSpaceArg,
+                               cl::Buffer>(*this, "energy");
+    }
+
+    auto get_energy_half_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl_ulong,
+                               cl::LocalSpaceArg,
+                               cl::Buffer>(*this, "energy_half");
+    }
+
+private:
+    static const std::string source;
+};
@@ -0,0 +1,118 @@
+#include "slab_decomposition.h"
+
+#include "logger.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+SlabDecomposition::size_type SlabDecomposition::Slab::get_owned() const {
+    return end - begin;
+}
+
+SlabDecomposition::size_type SlabDecomposition::Slab::get_halo() const {
+    return nodes.size() - get_owned();
+}
+
+SlabDecomposition::SlabDecomposition(const vector<Node> & nodes,
+                                     size_type count)
+        : local_index(nodes.size()) {
+    if (count == 0)
+        throw runtime_error("a mesh can't be split into zero slabs");
+
+    for (auto i = 0u; i != count; ++i) {
+        Slab slab;
+        slab.begin = nodes.size() * i / count;
+        slab.end = nodes.size() * (i + 1) / count;
+        slabs.push_back(slab);
+    }
+
+    vector<char> sent(nodes.size(), false);
+    for (auto i = 0u; i != nodes.size(); ++i) {
+        for (auto port : nodes[i].ports) {
+            if (port >= 0 && get_slab(port) != get_slab(i))
+                sent[port] = true;
+        }
+    }
+
+    for (auto & slab : slabs) {
+        for (auto i = slab.begin; i != slab.end; ++i) {
+            if (sent[i])
+                slab.nodes.push_back(i);
+        }
+        slab.send = slab.nodes.size();
+        for (auto i = slab.begin; i != slab.end; ++i) {
+            if (!sent[i])
+                slab.nodes.push_back(i);
+        }
+        for (auto j = 0u; j != slab.nodes.size(); ++j)
+            local_index[slab.nodes[j]] = j;
+
+        vector<size_type> halo;
+        for (auto i = slab.begin; i != slab.end; ++i) {
+            for (auto port : nodes[i].ports) {
+                if (port < 0)
+                    continue;
+                size_type index = port;
+                if (index < slab.begin || slab.end <= index)
+                    halo.push_back(index);
+            }
+        }
+        sort(halo.begin(), halo.end());
+        halo.erase(unique(halo.begin(), halo.end()), halo.end());
+        slab.nodes.insert(slab.nodes.end(), halo.begin(), halo.end());
+    }
+
+    auto total_halo = 0u;
+    for (auto & slab : slabs) {
+        auto halo_begin = slab.nodes.begin() + slab.get_owned();
+        auto local = [&](size_type index) -> cl_int {
+            if (slab.begin <= index && index < slab.end)
+                return local_index[index];
+            return lower_bound(halo_begin, slab.nodes.end(), index) -
+                   slab.nodes.begin();
+        };
+
+        for (auto j = 0u; j != slab.get_owned(); ++j) {
+            const auto & node = nodes[slab.nodes[j]];
+            cl_int4 ports;
+            for (auto k = 0; k != 4; ++k) {
+                auto port = node.ports[k];
+                ports.s[k] = port >= 0 ? local(port) : -1;
+            }
+            slab.ports.push_back(ports);
+
+            (j < slab.send ? slab.send_list : slab.rest_list).push_back(j);
+        }
+
+        for (auto i = halo_begin; i != slab.nodes.end(); ++i)
+            slab.halo_sources.emplace_back(get_slab(*i), local_index[*i]);
+
+        total_halo += slab.get_halo();
+    }
+
+    Logger::log("split ",
+                nodes.size(),
+                " nodes into ",
+                count,
+                " slabs with ",
+                total_halo,
+                " halo nodes");
+}
+
+SlabDecomposition::size_type SlabDecomposition::get_slab(
+    size_type index) const {
+    //  empty slabs share their begin with the next slab, so take the last
+    //  slab which begins at or before index
+    auto it = upper_bound(
+        slabs.begin(), slabs.end(), index, [](auto index, const auto & slab) {
+            return index < slab.begin;
+        });
+    return it - slabs.begin() - 1;
+}
+
+SlabDecomposition::size_type SlabDecomposition::get_local_index(
+    size_type index) const {
+    return local_index[index];
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "cl_structs.h"
+
+#include <vector>
+
+/// Splits a tetrahedral mesh into contiguous ranges of nodes, one per
+/// device.
+/// In grid order a contiguous range is a slab of the room, so only the
+/// nodes on either face of a slab are shared with its neighbours.
+/// Each slab stores its own nodes and a one-node halo of the neighbouring
+/// nodes its own nodes read, with ports rewritten as local indices.
+class SlabDecomposition {
+public:
+    using size_type = std::vector<Node>::size_type;
+
+    struct Slab {
+        /// The range of mesh indices owned by this slab.
+        size_type begin;
+        size_type end;
+
+        /// The mesh index of each local node.
+        /// Owned nodes which other slabs read come first, so that they can
+        /// be read back in one go, then the rest of the owned nodes, then
+        /// the halo.
+        std::vector<size_type> nodes;
+
+        /// The number of owned nodes which other slabs read.
+        size_type send;
+
+        /// Ports of the owned nodes as local indices, with -1 for ports
+        /// which don't exist or are outside the boundary.
+        std::vector<cl_int4> ports;
+
+        /// Local indices of owned nodes, split into those which other slabs
+        /// read and the rest.
+        std::vector<cl_uint> send_list;
+        std::vector<cl_uint> rest_list;
+
+        /// For each halo node, the slab which owns it and its local index
+        /// in that slab, which is always below that slab's send.
+        std::vector<std::pair<size_type, size_type>> halo_sources;
+
+        size_type get_owned() const;
+        size_type get_halo() const;
+    };
+
+    SlabDecomposition(const std::vector<Node> & nodes, size_type slabs);
+
+    /// The slab which owns mesh node index.
+    size_type get_slab(size_type index) const;
+
+    /// The local index of mesh node index in the slab which owns it.
+    size_type get_local_index(size_type index) const;
+
+    /// Gathers the halo of every slab from the values read back from the
+    /// slabs which own it.
+    /// sent[i] holds the first slabs[i].send local values of slab i.
+    /// halo[i] is filled in the order of slab i's halo nodes, so it can be
+    /// written straight after that slab's owned nodes.
+    template <typename T>
+    void exchange(const std::vector<std::vector<T>> & sent,
+                  std::vector<std::vector<T>> & halo) const {
+        halo.resize(slabs.size());
+        for (auto d = 0u; d != slabs.size(); ++d) {
+            const auto & slab = slabs[d];
+            halo[d].resize(slab.get_halo());
+            for (auto j = 0u; j != halo[d].size(); ++j) {
+                const auto & from = slab.halo_sources[j];
+                halo[d][j] = sent[from.first][from.second];
+            }
+        }
+    }
+
+    std::vector<Slab> slabs;
+
+private:
+    std::vector<cl_uint> local_index;
+};
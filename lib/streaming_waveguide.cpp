@@ -0,0 +1,253 @@
+#include "streaming_waveguide.h"
+
+#include <iostream>
+#include <numeric>
+
+using namespace std;
+
+StreamingTetrahedralWaveguide::Slot::Slot(const cl::CommandQueue & queue,
+                                          const cl::Context & context,
+                                          size_type nodes)
+        : queue(queue)
+        , port_buffer(context, CL_MEM_READ_ONLY, sizeof(cl_int4) * nodes)
+        , storage({{cl::Buffer(context,
+                               CL_MEM_READ_WRITE,
+                               sizeof(cl_float) * nodes),
+                    cl::Buffer(context,
+                               CL_MEM_READ_WRITE,
+                               sizeof(cl_float) * nodes)}}) {
+}
+
+StreamingTetrahedralWaveguide::StreamingTetrahedralWaveguide(
+    const TetrahedralProgram & program,
+    cl::CommandQueue & queue,
+    const Boundary & boundary,
+    float cube_side,
+    size_type slab_nodes,
+    unsigned blocking_factor)
+        : BasicTetrahedralWaveguide(boundary, cube_side)
+        , slab_nodes(max(size_type{1}, slab_nodes))
+        , blocking_factor(max(1u, blocking_factor))
+        , slabs(get_slabs())
+        , max_local(max_element(slabs.begin(),
+                                slabs.end(),
+                                [](const auto & a, const auto & b) {
+                                    return a.nodes.size() < b.nodes.size();
+                                })->nodes.size())
+        , kernel(program.get_kernel())
+        , record_kernel(program.get_record_kernel())
+        , context(program.getInfo<CL_PROGRAM_CONTEXT>())
+        , slots({{Slot(queue, context, max_local),
+                  Slot(cl::CommandQueue(context,
+                                        queue.getInfo<CL_QUEUE_DEVICE>()),
+                       context,
+                       max_local)}}) {
+    //  every slab is stepped from its first local node, so one list serves
+    //  them all
+    vector<cl_uint> indices(max_local);
+    iota(indices.begin(), indices.end(), 0);
+    node_list = cl::Buffer(context, indices.begin(), indices.end(), true);
+
+    Logger::log("streaming ",
+                mesh.nodes.size(),
+                " nodes in ",
+                slabs.size(),
+                " slabs of up to ",
+                max_local,
+                " nodes including halo, using ",
+                max_local * (2 * (sizeof(cl_int4) + 2 * sizeof(cl_float)) +
+                             sizeof(cl_uint)),
+                " bytes of device memory");
+}
+
+vector<IterativeTetrahedralMesh::Tile>
+StreamingTetrahedralWaveguide::get_slabs() const {
+    auto nodes = mesh.nodes.size();
+    if (!nodes)
+        throw runtime_error("streaming waveguide mesh has no nodes");
+
+    vector<IterativeTetrahedralMesh::Tile> ret;
+    vector<int> local(nodes, -1);
+    for (size_type begin = 0; begin < nodes; begin += slab_nodes) {
+        ret.push_back(mesh.get_tile(
+            begin, min(nodes, begin + slab_nodes), blocking_factor, local));
+    }
+    return ret;
+}
+
+vector<vector<cl_float>> StreamingTetrahedralWaveguide::run(
+    size_type source, const vector<size_type> & receivers, size_type steps) {
+    check_receiver(source);
+    for (auto i : receivers)
+        check_receiver(i);
+
+    Logger::log("beginning streaming simulation with: ",
+                mesh.nodes.size(),
+                " nodes, ",
+                receivers.size(),
+                " receivers and blocking factor ",
+                blocking_factor);
+
+    auto nodes = mesh.nodes.size();
+
+    //  the state before and after each block of steps, because slabs which
+    //  haven't been processed yet still need the old values for their halos
+    vector<cl_float> in_current(nodes, 0);
+    vector<cl_float> in_previous(nodes, 0);
+    vector<cl_float> out_current(nodes);
+    vector<cl_float> out_previous(nodes);
+    in_current[source] = 1;
+
+    //  receivers in each slab, as indices into receivers
+    vector<vector<size_type>> slab_receivers(slabs.size());
+    for (auto r = 0u; r != receivers.size(); ++r)
+        slab_receivers[receivers[r] / slab_nodes].push_back(r);
+
+    vector<cl::Buffer> receiver_buffers(slabs.size());
+    auto max_width = size_type{1};
+    for (auto i = 0u; i != slabs.size(); ++i) {
+        if (slab_receivers[i].empty())
+            continue;
+        vector<cl_ulong> indices;
+        for (auto r : slab_receivers[i])
+            indices.push_back(receivers[r] - slabs[i].begin);
+        receiver_buffers[i] =
+            cl::Buffer(context, indices.begin(), indices.end(), true);
+        max_width = max(max_width, indices.size());
+    }
+
+    array<cl::Buffer, 2> outputs{
+        {cl::Buffer(context,
+                    CL_MEM_READ_WRITE,
+                    sizeof(cl_float) * blocking_factor * max_width),
+         cl::Buffer(context,
+                    CL_MEM_READ_WRITE,
+                    sizeof(cl_float) * blocking_factor * max_width)}};
+
+    //  host copies which must outlive the transfers of a whole block
+    vector<vector<cl_float>> halo_current(slabs.size());
+    vector<vector<cl_float>> halo_previous(slabs.size());
+    vector<vector<cl_float>> recorded(slabs.size());
+    for (auto i = 0u; i != slabs.size(); ++i) {
+        auto halo = slabs[i].nodes.size() - (slabs[i].end - slabs[i].begin);
+        halo_current[i].resize(halo);
+        halo_previous[i].resize(halo);
+        recorded[i].resize(blocking_factor * slab_receivers[i].size());
+    }
+
+    vector<vector<cl_float>> ret(receivers.size(), vector<cl_float>(steps));
+
+    for (size_type block = 0; block < steps; block += blocking_factor) {
+        auto length = min<size_type>(blocking_factor, steps - block);
+
+        //  slabs alternate between the two slots, so while one slot is
+        //  computing the other is uploading or reading back
+        for (auto i = 0u; i != slabs.size(); ++i) {
+            const auto & slab = slabs[i];
+            auto & slot = slots[i % 2];
+            auto & queue = slot.queue;
+            auto & output = outputs[i % 2];
+            auto owned = slab.end - slab.begin;
+            auto halo = halo_current[i].size();
+
+            for (auto j = 0u; j != halo; ++j) {
+                halo_current[i][j] = in_current[slab.nodes[owned + j]];
+                halo_previous[i][j] = in_previous[slab.nodes[owned + j]];
+            }
+
+            queue.enqueueWriteBuffer(slot.port_buffer,
+                                     CL_FALSE,
+                                     0,
+                                     sizeof(cl_int4) * slab.ports.size(),
+                                     slab.ports.data());
+
+            auto upload = [&](auto & buffer,
+                              const auto & field,
+                              const auto & halo_field) {
+                queue.enqueueWriteBuffer(buffer,
+                                         CL_FALSE,
+                                         0,
+                                         sizeof(cl_float) * owned,
+                                         field.data() + slab.begin);
+                if (halo) {
+                    queue.enqueueWriteBuffer(buffer,
+                                             CL_FALSE,
+                                             sizeof(cl_float) * owned,
+                                             sizeof(cl_float) * halo,
+                                             halo_field.data());
+                }
+            };
+
+            auto previous = 0u;
+            auto current = 1u;
+            upload(slot.storage[previous], in_previous, halo_previous[i]);
+            upload(slot.storage[current], in_current, halo_current[i]);
+
+            auto width = slab_receivers[i].size();
+            slab.step(length, [&](auto valid, auto step) {
+                kernel(cl::EnqueueArgs(queue, cl::NDRange(valid)),
+                       slot.storage[current],
+                       slot.storage[previous],
+                       slot.port_buffer,
+                       node_list);
+                if (width) {
+                    record_kernel(
+                        cl::EnqueueArgs(queue, cl::NDRange(width)),
+                        slot.storage[previous],
+                        receiver_buffers[i],
+                        output,
+                        step * width);
+                }
+                swap(previous, current);
+            });
+
+            queue.enqueueReadBuffer(slot.storage[current],
+                                    CL_FALSE,
+                                    0,
+                                    sizeof(cl_float) * owned,
+                                    out_current.data() + slab.begin);
+            queue.enqueueReadBuffer(slot.storage[previous],
+                                    CL_FALSE,
+                                    0,
+                                    sizeof(cl_float) * owned,
+                                    out_previous.data() + slab.begin);
+            if (width) {
+                queue.enqueueReadBuffer(output,
+                                        CL_FALSE,
+                                        0,
+                                        sizeof(cl_float) * length * width,
+                                        recorded[i].data());
+            }
+
+            queue.flush();
+        }
+
+        for (auto & slot : slots)
+            slot.queue.finish();
+
+        swap(in_current, out_current);
+        swap(in_previous, out_previous);
+
+        for (auto i = 0u; i != slabs.size(); ++i) {
+            auto width = slab_receivers[i].size();
+            for (auto step = 0u; step != length; ++step) {
+                for (auto j = 0u; j != width; ++j) {
+                    ret[slab_receivers[i][j]][block + step] =
+                        recorded[i][step * width + j];
+                }
+            }
+        }
+
+        print_progress(block + length, steps);
+    }
+
+    std::cout << std::endl;
+
+    return ret;
+}
+
+vector<cl_float> StreamingTetrahedralWaveguide::run_basic(const Vec3f & e,
+                                                          size_type o,
+                                                          size_type steps) {
+    return run(get_index_for_coordinate(e), {o}, steps).front();
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "basic_tetrahedral_waveguide.h"
+
+/// A tetrahedral waveguide for meshes which don't fit in device memory.
+/// The mesh and both pressure fields stay in host memory, and the device
+/// only holds two slabs of slab_nodes nodes at a time.
+/// Each slab is sent along with a halo of every node within
+/// blocking_factor connections, advanced by blocking_factor steps, and its
+/// own nodes are read back, so each node crosses the bus once per
+/// blocking_factor steps rather than every step.
+/// The two slabs on the device use separate queues, so one slab can be
+/// transferred while the other is being computed.
+class StreamingTetrahedralWaveguide : public BasicTetrahedralWaveguide {
+public:
+    StreamingTetrahedralWaveguide(const TetrahedralProgram & program,
+                                  cl::CommandQueue & queue,
+                                  const Boundary & boundary,
+                                  float cube_side,
+                                  size_type slab_nodes,
+                                  unsigned blocking_factor);
+    virtual ~StreamingTetrahedralWaveguide() noexcept = default;
+
+    /// Run with an impulse at node source, recording every node in
+    /// receivers at every step.
+    /// Returns one signal per receiver.
+    std::vector<std::vector<cl_float>> run(
+        size_type source,
+        const std::vector<size_type> & receivers,
+        size_type steps);
+
+    std::vector<cl_float> run_basic(const Vec3f & e,
+                                    size_type o,
+                                    size_type steps) override;
+
+private:
+    using kernel_type =
+        decltype(std::declval<TetrahedralProgram>().get_kernel());
+    using record_kernel_type =
+        decltype(std::declval<TetrahedralProgram>().get_record_kernel());
+
+    /// Device storage for one slab.
+    struct Slot {
+        Slot(const cl::CommandQueue & queue,
+             const cl::Context & context,
+             size_type nodes);
+
+        cl::CommandQueue queue;
+        cl::Buffer port_buffer;
+        std::array<cl::Buffer, 2> storage;
+    };
+
+    std::vector<IterativeTetrahedralMesh::Tile> get_slabs() const;
+
+    const size_type slab_nodes;
+    const unsigned blocking_factor;
+    std::vector<IterativeTetrahedralMesh::Tile> slabs;
+    size_type max_local;
+
+    kernel_type kernel;
+    record_kernel_type record_kernel;
+    cl::Context context;
+    std::array<Slot, 2> slots;
+    cl::Buffer node_list;
+};
@@ -1,4 +1,5 @@
 #include "tetrahedral_program.h"
+#include "waveguide_kernels.h"
 
 using namespace std;
 
@@ -8,38 +9,37 @@ TetrahedralProgram::TetrahedralProgram(const cl::Context & context,
 }
 
 const string TetrahedralProgram::source{
+    waveguide_kernel_source +
 #ifdef DIAGNOSTIC
     "#define DIAGNOSTIC\n"
 #endif
     R"(
     #define PORTS (4)
+    #define CUBE_NODES (8)
 
-    typedef struct {
-        int ports[PORTS];
-        float3 position;
-        bool inside;
-    } Node;
-
+    //  Only nodes inside the boundary are stored, so there is no inside
+    //  mask, and each work-item loads just its ports and pressures.
+    //  ports holds the indices of each node's neighbours, where -1 marks a
+    //  neighbour which doesn't exist or is outside the boundary.
+    //  node_list holds the indices of the nodes to update, so that interior
+    //  and boundary nodes can be updated by different kernels.
     kernel void waveguide
     (   global float * current
     ,   global float * previous
-    ,   global Node * nodes
-    ,   unsigned long read
-    ,   global float * output
+    ,   global int4 * ports
+    ,   global uint * node_list
     ) {
-        size_t index = get_global_id(0);
-        global Node * node = nodes + index;
+        size_t index = node_list[get_global_id(0)];
 
-        if (! node->inside) {
-            return;
-        }
+        const int4 p = ports[index];
+        const int port_indices[PORTS] = {p.s0, p.s1, p.s2, p.s3};
 
         float temp = 0;
 
         //  waveguide logic goes here
         for (int i = 0; i != PORTS; ++i) {
-            int port_index = node->ports[i];
-            if (port_index >= 0 && nodes[port_index].inside)
+            int port_index = port_indices[i];
+            if (port_index >= 0)
                 temp += current[port_index];
         }
 
@@ -47,9 +47,164 @@ const string TetrahedralProgram::source{
         temp -= previous[index];
 
         previous[index] = temp;
+    }
+
+    //  Like waveguide, but for nodes where every neighbour is valid, which is
+    //  most of them, so there are no branches.
+    kernel void waveguide_interior
+    (   global float * current
+    ,   global float * previous
+    ,   global int4 * ports
+    ,   global uint * node_list
+    ) {
+        size_t index = node_list[get_global_id(0)];
+
+        const int4 p = ports[index];
+
+        float temp = current[p.s0] + current[p.s1] +
+                     current[p.s2] + current[p.s3];
+
+        temp /= 2;
+        temp -= previous[index];
+
+        previous[index] = temp;
+    }
 
-        if (index == read) {
-            *output = previous[index];
+    //  Like waveguide and waveguide_interior, but the fields are stored as
+    //  half precision to halve their memory traffic, and the arithmetic is
+    //  still done in float.
+    kernel void waveguide_half
+    (   global half * current
+    ,   global half * previous
+    ,   global int4 * ports
+    ,   global uint * node_list
+    ) {
+        size_t index = node_list[get_global_id(0)];
+
+        const int4 p = ports[index];
+        const int port_indices[PORTS] = {p.s0, p.s1, p.s2, p.s3};
+
+        float temp = 0;
+
+        for (int i = 0; i != PORTS; ++i) {
+            int port_index = port_indices[i];
+            if (port_index >= 0)
+                temp += vload_half(port_index, current);
         }
+
+        temp /= 2;
+        temp -= vload_half(index, previous);
+
+        vstore_half(temp, index, previous);
+    }
+
+    kernel void waveguide_interior_half
+    (   global half * current
+    ,   global half * previous
+    ,   global int4 * ports
+    ,   global uint * node_list
+    ) {
+        size_t index = node_list[get_global_id(0)];
+
+        const int4 p = ports[index];
+
+        float temp = vload_half(p.s0, current) + vload_half(p.s1, current) +
+                     vload_half(p.s2, current) + vload_half(p.s3, current);
+
+        temp /= 2;
+        temp -= vload_half(index, previous);
+
+        vstore_half(temp, index, previous);
+    }
+
+    //  Like waveguide, but with a separate source in each lane.
+    kernel void waveguide_multi
+    (   global float4 * current
+    ,   global float4 * previous
+    ,   global int4 * ports
+    ,   global uint * node_list
+    ) {
+        size_t index = node_list[get_global_id(0)];
+
+        const int4 p = ports[index];
+        const int port_indices[PORTS] = {p.s0, p.s1, p.s2, p.s3};
+
+        float4 temp = 0;
+
+        for (int i = 0; i != PORTS; ++i) {
+            int port_index = port_indices[i];
+            if (port_index >= 0)
+                temp += current[port_index];
+        }
+
+        temp /= 2;
+        temp -= previous[index];
+
+        previous[index] = temp;
+    }
+
+    //  The offset of each neighbour of each node in the cube, as
+    //  (x, y, z, node in cube).
+    //  Must match IterativeTetrahedralMesh::offset_table.
+    constant int4 offset_table[CUBE_NODES][PORTS] = {
+        {(int4)( 0,  0,  0, 2), (int4)(-1,  0, -1, 3),
+         (int4)(-1, -1,  0, 6), (int4)( 0, -1, -1, 7)},
+        {(int4)( 0,  0,  0, 2), (int4)( 0,  0,  0, 3),
+         (int4)( 0, -1,  0, 6), (int4)( 0, -1,  0, 7)},
+        {(int4)( 0,  0,  0, 0), (int4)( 0,  0,  0, 1),
+         (int4)( 0,  0,  0, 4), (int4)( 0,  0,  0, 5)},
+        {(int4)( 1,  0,  1, 0), (int4)( 0,  0,  0, 1),
+         (int4)( 0,  0,  1, 4), (int4)( 1,  0,  0, 5)},
+        {(int4)( 0,  0,  0, 2), (int4)( 0,  0, -1, 3),
+         (int4)( 0,  0,  0, 6), (int4)( 0,  0, -1, 7)},
+        {(int4)( 0,  0,  0, 2), (int4)(-1,  0,  0, 3),
+         (int4)(-1,  0,  0, 6), (int4)( 0,  0,  0, 7)},
+        {(int4)( 1,  1,  0, 0), (int4)( 0,  1,  0, 1),
+         (int4)( 0,  0,  0, 4), (int4)( 1,  0,  0, 5)},
+        {(int4)( 0,  1,  1, 0), (int4)( 0,  1,  0, 1),
+         (int4)( 0,  0,  1, 4), (int4)( 0,  0,  0, 5)},
+    };
+
+    //  Like waveguide, but works over the full grid of nodes covering the
+    //  bounding box, and finds neighbours from the node index rather than
+    //  loading them from memory.
+    //  The grid includes nodes outside the boundary, so this is the only
+    //  tetrahedral kernel which needs an inside mask.
+    //  dim is the size of the grid in cubes.
+    kernel void waveguide_implicit
+    (   global float * current
+    ,   global float * previous
+    ,   global uint * inside
+    ,   int4 dim
+    ) {
+        size_t index = get_global_id(0);
+
+        if (! is_inside(inside, index)) {
+            return;
+        }
+
+        int mod_ind = index % CUBE_NODES;
+        int cube = index / CUBE_NODES;
+        int3 pos = (int3)(cube % dim.x,
+                          (cube / dim.x) % dim.y,
+                          cube / (dim.x * dim.y));
+
+        float temp = 0;
+
+        for (int i = 0; i != PORTS; ++i) {
+            int4 relative = offset_table[mod_ind][i];
+            int3 summed = pos + relative.xyz;
+            if (all(summed >= 0) && all(summed < dim.xyz)) {
+                int port_index = relative.w + CUBE_NODES *
+                    (summed.x + dim.x * (summed.y + dim.y * summed.z));
+                if (is_inside(inside, port_index))
+                    temp += current[port_index];
+            }
+        }
+
+        temp /= 2;
+        temp -= previous[index];
+
+        previous[index] = temp;
     }
     )"};
@@ -12,10 +12,73 @@ public:
         return cl::make_kernel<cl::Buffer,
                                cl::Buffer,
                                cl::Buffer,
-                               cl_ulong,
                                cl::Buffer>(*this, "waveguide");
     }
 
+    auto get_interior_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer>(*this, "waveguide_interior");
+    }
+
+    auto get_half_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer>(*this, "waveguide_half");
+    }
+
+    auto get_interior_half_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer>(*this, "waveguide_interior_half");
+    }
+
+    auto get_multi_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer>(*this, "waveguide_multi");
+    }
+
+    auto get_implicit_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl_int4>(*this, "waveguide_implicit");
+    }
+
+    auto get_record_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_ulong>(
+            *this, "record_receivers");
+    }
+
+    auto get_multi_record_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_ulong>(
+            *this, "record_receivers_multi");
+    }
+
+    auto get_record_half_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer, cl_ulong>(
+            *this, "record_receivers_half");
+    }
+
+    auto get_energy_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl_ulong,
+                               cl::LocalSpaceArg,
+                               cl::Buffer>(*this, "energy");
+    }
+
+    auto get_energy_half_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl_ulong,
+                               cl::LocalSpaceArg,
+                               cl::Buffer>(*this, "energy_half");
+    }
+
 private:
     static const std::string source;
 };
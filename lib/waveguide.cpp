@@ -1,22 +1,43 @@
 #include "waveguide.h"
+#include "cl_common.h"
 #include "test_flag.h"
 #include "conversions.h"
 
 #include <iostream>
 #include <algorithm>
 #include <cstdlib>
+#include <numeric>
 
 using namespace std;
 
 TetrahedralWaveguide::TetrahedralWaveguide(const TetrahedralProgram & program,
                                            cl::CommandQueue & queue,
-                                           const std::vector<Node> & nodes)
-        : Waveguide<TetrahedralProgram>(program, queue, nodes.size())
+                                           const std::vector<Node> & nodes,
+                                           bool half_fields)
+        : Waveguide<TetrahedralProgram>(
+              program, queue, nodes.size(), half_fields)
+        , interior_kernel(program.get_interior_kernel())
+        , half_kernel(program.get_half_kernel())
+        , interior_half_kernel(program.get_interior_half_kernel())
+        , multi_kernel(program.get_multi_kernel())
         , nodes(nodes)
-        , node_buffer(program.getInfo<CL_PROGRAM_CONTEXT>(),
-                      this->nodes.begin(),
-                      this->nodes.end(),
-                      true) {
+        , ports(get_ports(nodes))
+        , interior(get_node_list(nodes, ports, true))
+        , boundary(get_node_list(nodes, ports, false))
+        , port_buffer(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                      ports.begin(),
+                      ports.end(),
+                      true)
+        , interior_buffer(make_buffer(
+              program.getInfo<CL_PROGRAM_CONTEXT>(), interior))
+        , boundary_buffer(make_buffer(
+              program.getInfo<CL_PROGRAM_CONTEXT>(), boundary)) {
+    Logger::log("waveguide has ",
+                interior.size(),
+                " interior nodes and ",
+                boundary.size(),
+                " boundary nodes");
+
 #ifdef TESTING
     auto fname = build_string("./file-positions.txt");
     ofstream file(fname);
@@ -32,70 +53,340 @@ TetrahedralWaveguide::TetrahedralWaveguide(const TetrahedralProgram & program,
 #endif
 }
 
-cl_float TetrahedralWaveguide::run_step(size_type o,
-                                        cl::CommandQueue & queue,
-                                        kernel_type & kernel,
-                                        size_type nodes,
-                                        cl::Buffer & previous,
-                                        cl::Buffer & current,
-                                        cl::Buffer & output) {
-    if (o > this->nodes.size()) {
+vector<cl_int4> TetrahedralWaveguide::get_ports(const vector<Node> & nodes) {
+    vector<cl_int4> ret(nodes.size());
+    for (auto i = 0u; i != nodes.size(); ++i) {
+        for (auto j = 0; j != IterativeTetrahedralMesh::PORTS; ++j) {
+            ret[i].s[j] = nodes[i].ports[j];
+        }
+    }
+    return ret;
+}
+
+vector<cl_uint> TetrahedralWaveguide::get_node_list(
+    const vector<Node> & nodes, const vector<cl_int4> & ports, bool interior) {
+    vector<cl_uint> ret;
+    for (auto i = 0u; i != nodes.size(); ++i) {
+        auto valid = all_of(begin(ports[i].s),
+                            end(ports[i].s),
+                            [](auto port) { return port >= 0; });
+        if (valid == interior)
+            ret.push_back(i);
+    }
+    return ret;
+}
+
+vector<cl_uint> TetrahedralWaveguide::get_distances(
+    const vector<cl_int4> & ports, const vector<cl_float> & initial) {
+    vector<cl_uint> ret(ports.size(), -1);
+    vector<cl_uint> frontier;
+    for (auto i = 0u; i != initial.size(); ++i) {
+        if (initial[i] != 0) {
+            ret[i] = 0;
+            frontier.push_back(i);
+        }
+    }
+
+    //  ports are symmetric, so the nodes a node reads from are also the
+    //  nodes which read from it
+    for (auto i = 0u; i != frontier.size(); ++i) {
+        auto node = frontier[i];
+        for (auto port : ports[node].s) {
+            if (port >= 0 && ret[port] == cl_uint(-1)) {
+                ret[port] = ret[node] + 1;
+                frontier.push_back(port);
+            }
+        }
+    }
+    return ret;
+}
+
+TetrahedralWaveguide::ActiveList::ActiveList(
+    const vector<cl_uint> & list, const vector<cl_uint> & distances)
+        : nodes(list) {
+    stable_sort(nodes.begin(), nodes.end(), [&distances](auto a, auto b) {
+        return distances[a] < distances[b];
+    });
+
+    //  unreachable nodes sort last, and are never part of the active region
+    for (auto i : nodes) {
+        auto distance = distances[i];
+        if (distance == cl_uint(-1))
+            break;
+        if (within.size() <= distance)
+            within.resize(distance + 1, 0);
+        within[distance] += 1;
+    }
+    partial_sum(within.begin(), within.end(), within.begin());
+}
+
+void TetrahedralWaveguide::begin_run(const vector<cl_float> & initial) {
+    step = 0;
+    active = get_active_region();
+    if (!active)
+        return;
+
+    auto distances = get_distances(ports, initial);
+    active_interior = ActiveList(interior, distances);
+    active_boundary = ActiveList(boundary, distances);
+    for (auto list : {&active_interior, &active_boundary})
+        list->buffer = make_buffer(get_context(), list->nodes);
+}
+
+void TetrahedralWaveguide::check_receiver(size_type o) const {
+    if (o >= this->nodes.size()) {
         throw runtime_error("requested output node does not exist");
     }
+}
 
-    if (!this->nodes[o].inside) {
-        throw runtime_error("requested output node is outside boundary");
+void TetrahedralWaveguide::enqueue_step(cl::CommandQueue & queue,
+                                        kernel_type & kernel,
+                                        size_type nodes,
+                                        cl::Buffer & previous,
+                                        cl::Buffer & current) {
+    //  once the region covers every reachable node, the original lists are
+    //  in a better order for memory access
+    auto covered = max(active_interior.within.size(),
+                       active_boundary.within.size());
+    if (active && covered <= step) {
+        Logger::log("active region covered the mesh after ", step, " steps");
+        active = false;
     }
 
-    vector<cl_float> out(1);
+    //  nodes more than step + 1 connections from the excitation are still
+    //  zero after this step, and need not be launched
+    auto enqueue = [&](auto & kernel,
+                       const auto & list,
+                       const auto & buffer,
+                       const auto & active_list) {
+        auto count = list.size();
+        auto launch_buffer = buffer;
+        if (active) {
+            const auto & within = active_list.within;
+            count = within.empty() ? 0
+                                   : within[min(step + 1, within.size() - 1)];
+            launch_buffer = active_list.buffer;
+        }
 
-    kernel(cl::EnqueueArgs(queue, cl::NDRange(nodes)),
-           current,
-           previous,
-           node_buffer,
-           o,
-           output);
+        if (count) {
+            kernel(cl::EnqueueArgs(queue, cl::NDRange(count)),
+                   current,
+                   previous,
+                   port_buffer,
+                   launch_buffer);
+        }
+    };
 
-    cl::copy(queue, output, out.begin(), out.end());
+    if (get_half_fields()) {
+        enqueue(interior_half_kernel,
+                interior,
+                interior_buffer,
+                active_interior);
+        enqueue(half_kernel, boundary, boundary_buffer, active_boundary);
+    } else {
+        enqueue(interior_kernel, interior, interior_buffer, active_interior);
+        enqueue(kernel, boundary, boundary_buffer, active_boundary);
+    }
+    step += 1;
 
 #ifdef TESTING
     static size_type ind = 0;
 
     vector<cl_float> node_values(nodes);
-    cl::copy(queue, previous, node_values.begin(), node_values.end());
+    if (get_half_fields()) {
+        vector<cl_half> half_values(nodes);
+        cl::copy(queue, previous, half_values.begin(), half_values.end());
+        transform(half_values.begin(),
+                  half_values.end(),
+                  node_values.begin(),
+                  half_to_float);
+    } else {
+        cl::copy(queue, previous, node_values.begin(), node_values.end());
+    }
     auto fname = build_string("./file-", ind++, ".txt");
     ofstream file(fname);
     for (auto j = 0u; j != nodes; ++j) {
         file << build_string(node_values[j]) << endl;
     }
 #endif
+}
+
+void TetrahedralWaveguide::enqueue_multi_step(cl::CommandQueue & queue,
+                                              size_type nodes,
+                                              cl::Buffer & previous,
+                                              cl::Buffer & current) {
+    auto enqueue = [&](const auto & list, auto & buffer) {
+        if (!list.empty()) {
+            multi_kernel(cl::EnqueueArgs(queue, cl::NDRange(list.size())),
+                         current,
+                         previous,
+                         port_buffer,
+                         buffer);
+        }
+    };
 
-    return out.front();
+    enqueue(interior, interior_buffer);
+    enqueue(boundary, boundary_buffer);
 }
 
 IterativeTetrahedralWaveguide::IterativeTetrahedralWaveguide(
     const TetrahedralProgram & program,
     cl::CommandQueue & queue,
     const Boundary & boundary,
-    float cube_side)
+    float cube_side,
+    bool morton_order,
+    bool half_fields)
         : IterativeTetrahedralWaveguide(
-              program, queue, IterativeTetrahedralMesh(boundary, cube_side)) {
+              program,
+              queue,
+              IterativeTetrahedralMesh(boundary, cube_side, morton_order),
+              half_fields) {
 }
 
 IterativeTetrahedralWaveguide::IterativeTetrahedralWaveguide(
     const TetrahedralProgram & program,
     cl::CommandQueue & queue,
-    const IterativeTetrahedralMesh & mesh)
-        : TetrahedralWaveguide(program, queue, mesh.nodes)
+    const IterativeTetrahedralMesh & mesh,
+    bool half_fields)
+        : TetrahedralWaveguide(program, queue, mesh.nodes, half_fields)
         , mesh(mesh) {
 }
 
 IterativeTetrahedralWaveguide::size_type
 IterativeTetrahedralWaveguide::get_index_for_coordinate(const Vec3f & v) const {
-    return mesh.get_index(mesh.get_locator(v));
+    return mesh.get_node_index_for_coordinate(v);
 }
 
 Vec3f IterativeTetrahedralWaveguide::get_coordinate_for_index(
     size_type index) const {
     return convert(mesh.nodes[index].position);
 }
+
+ImplicitTetrahedralWaveguide::ImplicitTetrahedralWaveguide(
+    const TetrahedralProgram & program,
+    cl::CommandQueue & queue,
+    const Boundary & boundary,
+    float cube_side)
+        : ImplicitTetrahedralWaveguide(
+              program, queue, IterativeTetrahedralMesh(boundary, cube_side)) {
+}
+
+ImplicitTetrahedralWaveguide::ImplicitTetrahedralWaveguide(
+    const TetrahedralProgram & program,
+    cl::CommandQueue & queue,
+    const IterativeTetrahedralMesh & mesh)
+        : Waveguide<TetrahedralProgram>(program, queue, mesh.index_map.size())
+        , mesh(mesh)
+        , implicit_kernel(program.get_implicit_kernel())
+        , inside_mask(get_inside_mask(mesh))
+        , inside_buffer(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                        inside_mask.begin(),
+                        inside_mask.end(),
+                        true) {
+}
+
+vector<cl_uint> ImplicitTetrahedralWaveguide::get_inside_mask(
+    const IterativeTetrahedralMesh & mesh) {
+    vector<cl_uint> ret((mesh.index_map.size() + 31) / 32, 0);
+    for (auto i = 0u; i != mesh.index_map.size(); ++i) {
+        if (mesh.index_map[i] >= 0)
+            ret[i / 32] |= 1u << (i % 32);
+    }
+    return ret;
+}
+
+void ImplicitTetrahedralWaveguide::check_receiver(size_type o) const {
+    if (o >= mesh.index_map.size()) {
+        throw runtime_error("requested output node does not exist");
+    }
+
+    if (mesh.index_map[o] < 0) {
+        throw runtime_error("requested output node is outside boundary");
+    }
+}
+
+void ImplicitTetrahedralWaveguide::enqueue_step(cl::CommandQueue & queue,
+                                                kernel_type & kernel,
+                                                size_type nodes,
+                                                cl::Buffer & previous,
+                                                cl::Buffer & current) {
+    implicit_kernel(cl::EnqueueArgs(queue, cl::NDRange(nodes)),
+                    current,
+                    previous,
+                    inside_buffer,
+                    cl_int4{{mesh.dim.x, mesh.dim.y, mesh.dim.z, 0}});
+}
+
+ImplicitTetrahedralWaveguide::size_type
+ImplicitTetrahedralWaveguide::get_index_for_coordinate(const Vec3f & v) const {
+    auto locator = mesh.get_locator(v);
+    if (mesh.get_node_index(locator) < 0)
+        throw runtime_error("requested coordinate is outside boundary");
+    return mesh.get_index(locator);
+}
+
+Vec3f ImplicitTetrahedralWaveguide::get_coordinate_for_index(
+    size_type index) const {
+    return mesh.get_position(mesh.get_locator(index));
+}
+
+RectilinearWaveguide::RectilinearWaveguide(const RectilinearProgram & program,
+                                           cl::CommandQueue & queue,
+                                           const Boundary & boundary,
+                                           float spacing,
+                                           bool half_fields)
+        : RectilinearWaveguide(program,
+                               queue,
+                               RectilinearMesh(boundary, spacing),
+                               half_fields) {
+}
+
+RectilinearWaveguide::RectilinearWaveguide(const RectilinearProgram & program,
+                                           cl::CommandQueue & queue,
+                                           const RectilinearMesh & mesh,
+                                           bool half_fields)
+        : Waveguide<RectilinearProgram>(
+              program, queue, mesh.get_nodes(), half_fields)
+        , mesh(mesh)
+        , half_kernel(program.get_half_kernel())
+        , inside_buffer(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                        this->mesh.inside_mask.begin(),
+                        this->mesh.inside_mask.end(),
+                        true) {
+}
+
+void RectilinearWaveguide::check_receiver(size_type o) const {
+    if (o >= mesh.get_nodes()) {
+        throw runtime_error("requested output node does not exist");
+    }
+
+    if (!mesh.inside(o)) {
+        throw runtime_error("requested output node is outside boundary");
+    }
+}
+
+void RectilinearWaveguide::enqueue_step(cl::CommandQueue & queue,
+                                        kernel_type & kernel,
+                                        size_type nodes,
+                                        cl::Buffer & previous,
+                                        cl::Buffer & current) {
+    auto & step_kernel = get_half_fields() ? half_kernel : kernel;
+    step_kernel(cl::EnqueueArgs(queue, cl::NDRange(nodes)),
+                current,
+                previous,
+                inside_buffer,
+                cl_int4{{mesh.dim.x, mesh.dim.y, mesh.dim.z, 0}});
+}
+
+RectilinearWaveguide::size_type RectilinearWaveguide::get_index_for_coordinate(
+    const Vec3f & v) const {
+    auto locator = mesh.get_locator(v);
+    auto in_grid = (Vec3i(0) <= locator && locator < mesh.dim).all();
+    if (!in_grid || !mesh.inside(mesh.get_index(locator)))
+        throw runtime_error("requested coordinate is outside boundary");
+    return mesh.get_index(locator);
+}
+
+Vec3f RectilinearWaveguide::get_coordinate_for_index(size_type index) const {
+    return mesh.get_position(mesh.get_locator(index));
+}
@@ -2,16 +2,115 @@
 
 #include "tetrahedral_program.h"
 #include "iterative_tetrahedral_mesh.h"
+#include "rectilinear_program.h"
+#include "rectilinear_mesh.h"
 #include "cl_structs.h"
 #include "logger.h"
 #include "conversions.h"
 
 #include <array>
+#include <cmath>
+#include <numeric>
 #include <type_traits>
 #include <algorithm>
+#include <iostream>
+
+/// The parts of a waveguide which don't depend on its program, so that
+/// waveguides with different topologies can be used interchangeably.
+class BasicWaveguide {
+public:
+    using size_type = std::vector<cl_float>::size_type;
+
+    virtual ~BasicWaveguide() noexcept = default;
+
+    virtual size_type get_index_for_coordinate(const Vec3f & v) const = 0;
+    virtual Vec3f get_coordinate_for_index(size_type index) const = 0;
+
+    /// Run with a single impulse at the node closest to e, recording node o.
+    virtual std::vector<cl_float> run_basic(const Vec3f & e,
+                                            size_type o,
+                                            size_type steps) = 0;
+
+    /// The number of steps to enqueue before reading back the output.
+    /// Each read blocks until the device is idle, so larger values remove
+    /// host round-trips at the cost of less frequent progress updates.
+    void set_steps_per_sync(size_type steps) {
+        steps_per_sync = std::max(size_type{1}, steps);
+    }
+
+    size_type get_steps_per_sync() const {
+        return steps_per_sync;
+    }
+
+    /// If enabled, waveguides which support it only update the nodes which
+    /// the initial excitation can have reached, until it has reached all of
+    /// them.
+    /// A node n connections from the excitation is zero for the first n - 1
+    /// steps, so the output is unchanged.
+    void set_active_region(bool enabled) {
+        active_region = enabled;
+    }
+
+    bool get_active_region() const {
+        return active_region;
+    }
+
+    /// If decay_db is above zero, waveguides which support it stop a run
+    /// early once the energy in the mesh has fallen decay_db below its peak.
+    /// The energy is only checked when the output is read back, once every
+    /// get_steps_per_sync() steps.
+    void set_decay_threshold(float decay_db) {
+        decay_threshold = decay_db;
+    }
+
+    float get_decay_threshold() const {
+        return decay_threshold;
+    }
+
+    /// Decides when a run has decayed, by comparing the energy in the mesh
+    /// with the largest energy passed in so far.
+    class DecayCheck {
+    public:
+        /// With decay_db at or below zero, a run never decays.
+        explicit DecayCheck(float decay_db)
+                : enabled(0 < decay_db)
+                , ratio(std::pow(10.0f, -decay_db / 10)) {
+        }
+
+        /// False if the energy doesn't need to be measured at all.
+        bool is_enabled() const {
+            return enabled;
+        }
+
+        /// True once energy has fallen decay_db below the peak.
+        bool operator()(float energy) {
+            if (!enabled)
+                return false;
+            peak = std::max(peak, energy);
+            return energy <= peak * ratio;
+        }
+
+    private:
+        const bool enabled;
+        const float ratio;
+        float peak{0};
+    };
+
+protected:
+    /// Shows how much of a run is done, on a line which is overwritten each
+    /// time.
+    static void print_progress(size_type done, size_type steps) {
+        std::cout << "\r" << done * 100 / steps << "% done" << std::flush;
+    }
+
+private:
+    size_type steps_per_sync{512};
+    bool active_region{false};
+    float decay_threshold{0};
+};
 
 template <typename T>
-class Waveguide {
+class Waveguide : public BasicWaveguide {
 public:
     struct PowerFunction {
         virtual float operator()(const Vec3f & a, const Vec3f & b) const = 0;
@@ -47,44 +146,81 @@ public:
         const float power;
     };
 
-    using size_type = std::vector<cl_float>::size_type;
     using kernel_type = decltype(std::declval<T>().get_kernel());
-
-    Waveguide(const T & program, cl::CommandQueue & queue, size_type nodes)
+    using record_kernel_type = decltype(std::declval<T>().get_record_kernel());
+    using multi_record_kernel_type =
+        decltype(std::declval<T>().get_multi_record_kernel());
+    using energy_kernel_type = decltype(std::declval<T>().get_energy_kernel());
+
+    /// If half_fields is true, the pressure fields are stored on the device
+    /// as half precision, and subclasses must step them with half kernels.
+    Waveguide(const T & program,
+              cl::CommandQueue & queue,
+              size_type nodes,
+              bool half_fields = false)
             : queue(queue)
             , kernel(program.get_kernel())
+            , record_kernel(program.get_record_kernel())
+            , record_half_kernel(program.get_record_half_kernel())
+            , multi_record_kernel(program.get_multi_record_kernel())
+            , energy_kernel(program.get_energy_kernel())
+            , energy_half_kernel(program.get_energy_half_kernel())
             , nodes(nodes)
-            , storage(
-                  {{cl::Buffer(program.template getInfo<CL_PROGRAM_CONTEXT>(),
-                               CL_MEM_READ_WRITE,
-                               sizeof(cl_float) * nodes),
-                    cl::Buffer(program.template getInfo<CL_PROGRAM_CONTEXT>(),
-                               CL_MEM_READ_WRITE,
-                               sizeof(cl_float) * nodes)}})
+            , half_fields(half_fields)
+            , context(program.template getInfo<CL_PROGRAM_CONTEXT>())
+            , storage({{cl::Buffer(context,
+                                   CL_MEM_READ_WRITE,
+                                   get_field_bytes()),
+                        cl::Buffer(context,
+                                   CL_MEM_READ_WRITE,
+                                   get_field_bytes())}})
+            , partial_buffer(context,
+                             CL_MEM_READ_WRITE,
+                             sizeof(cl_float) * ENERGY_GROUPS)
             , previous(&storage[0])
-            , current(&storage[1])
-            , output(program.template getInfo<CL_PROGRAM_CONTEXT>(),
-                     CL_MEM_READ_WRITE,
-                     sizeof(cl_float)) {
+            , current(&storage[1]) {
     }
 
     virtual ~Waveguide() noexcept = default;
 
-    virtual cl_float run_step(size_type o,
-                              cl::CommandQueue & queue,
+    /// Enqueue a single step without waiting for it to finish.
+    /// The new values are written to previous.
+    virtual void enqueue_step(cl::CommandQueue & queue,
                               kernel_type & kernel,
                               size_type nodes,
                               cl::Buffer & previous,
-                              cl::Buffer & current,
-                              cl::Buffer & output) = 0;
+                              cl::Buffer & current) = 0;
+
+    /// Enqueue a single step of the float4 pressure fields used by
+    /// run_multiple_sources.
+    virtual void enqueue_multi_step(cl::CommandQueue & queue,
+                                    size_type nodes,
+                                    cl::Buffer & previous,
+                                    cl::Buffer & current) {
+        throw std::runtime_error(
+            "this waveguide can't simulate multiple sources");
+    }
 
-    virtual size_type get_index_for_coordinate(const Vec3f & v) const = 0;
-    virtual Vec3f get_coordinate_for_index(size_type index) const = 0;
+    /// Throws if node o can't be used as a receiver.
+    virtual void check_receiver(size_type o) const = 0;
+
+    /// Called by run with the initial pressure field, before the first step.
+    virtual void begin_run(const std::vector<cl_float> & initial) {
+    }
 
     size_type get_nodes() const {
         return nodes;
     }
 
+    bool get_half_fields() const {
+        return half_fields;
+    }
+
+    /// The size of one pressure field on the device.
+    size_type get_field_bytes() const {
+        return (half_fields ? sizeof(cl_half) : sizeof(cl_float)) * nodes;
+    }
+
     std::vector<cl_float> initialise_mesh(const PowerFunction & u,
                                           const Vec3f & excitation) {
         std::vector<size_type> indices(nodes);
@@ -101,49 +237,159 @@ public:
         return ret;
     }
 
-    std::vector<cl_float> run(const Vec3f & e,
-                              const PowerFunction & u,
-                              size_type o,
-                              size_type steps) {
-        Logger::log("beginning simulation with: ", nodes, " nodes");
+    /// The sum of the squares of the values in field, which is proportional
+    /// to the potential energy in the mesh.
+    /// The sum is reduced on the device, and only the per-group results are
+    /// read back.
+    cl_float get_energy(cl::Buffer & field) {
+        auto & kernel = half_fields ? energy_half_kernel : energy_kernel;
+        kernel(cl::EnqueueArgs(queue,
+                               cl::NDRange(ENERGY_GROUPS * ENERGY_GROUP_SIZE),
+                               cl::NDRange(ENERGY_GROUP_SIZE)),
+               field,
+               nodes,
+               cl::Local(sizeof(cl_float) * ENERGY_GROUP_SIZE),
+               partial_buffer);
+
+        std::vector<cl_float> partial(ENERGY_GROUPS);
+        cl::copy(queue, partial_buffer, partial.begin(), partial.end());
+        return std::accumulate(partial.begin(), partial.end(), 0.0f);
+    }
+
+    /// Run the simulation once, recording every node in receivers at every
+    /// step.
+    /// If a decay threshold is set, the run may stop before steps, in which
+    /// case the signals are shorter.
+    /// Returns one signal per receiver.
+    std::vector<std::vector<cl_float>> run(
+        const Vec3f & e,
+        const PowerFunction & u,
+        const std::vector<size_type> & receivers,
+        size_type steps) {
+        Logger::log("beginning simulation with: ",
+                    nodes,
+                    " nodes and ",
+                    receivers.size(),
+                    " receivers");
 
         std::vector<cl_float> n(nodes, 0);
-        cl::copy(queue, n.begin(), n.end(), *previous);
+        upload(n, *previous);
 
         n = initialise_mesh(u, e);
-        cl::copy(queue, n.begin(), n.end(), *current);
-
-        std::vector<cl_float> ret(steps);
-
-        auto counter = 0u;
-        std::generate(
-            ret.begin(),
-            ret.end(),
-            [this, &counter, &steps, &o] {
-                auto ret = this->run_step(
-                    o, queue, kernel, nodes, *previous, *current, output);
-
-                std::swap(current, previous);
+        upload(n, *current);
+        begin_run(n);
+
+        DecayCheck decayed(get_decay_threshold());
+
+        return run_chunks<cl_float>(
+            previous,
+            current,
+            receivers,
+            steps,
+            [this](auto & previous, auto & current) {
+                this->enqueue_step(queue, kernel, nodes, previous, current);
+            },
+            half_fields ? record_half_kernel : record_kernel,
+            [this, &decayed](auto & current) {
+                return decayed.is_enabled() &&
+                       decayed(this->get_energy(current));
+            });
+    }
 
-                auto percent = counter * 100 / (steps - 1);
-                std::cout << "\r" << percent << "% done" << std::flush;
+    /// A source for run_multiple_sources.
+    struct Source {
+        Vec3f position;
+        const PowerFunction & u;
+    };
 
-                counter += 1;
+    /// The number of sources simulated together in one pass over the mesh.
+    static constexpr size_type SOURCE_LANES = 4;
+
+    /// Simulate several sources at once.
+    /// The scheme is linear, so each node holds a float4 with one source per
+    /// lane, and the sources share the cost of loading the mesh connectivity.
+    /// Sources are simulated in groups of SOURCE_LANES.
+    /// Returns a signal per receiver for each source.
+    std::vector<std::vector<std::vector<cl_float>>> run_multiple_sources(
+        const std::vector<Source> & sources,
+        const std::vector<size_type> & receivers,
+        size_type steps) {
+        Logger::log("beginning simulation with: ",
+                    nodes,
+                    " nodes, ",
+                    sources.size(),
+                    " sources and ",
+                    receivers.size(),
+                    " receivers");
+
+        std::vector<std::vector<std::vector<cl_float>>> ret;
+
+        std::array<cl::Buffer, 2> multi_storage{
+            {cl::Buffer(context,
+                        CL_MEM_READ_WRITE,
+                        sizeof(cl_float4) * nodes),
+             cl::Buffer(context,
+                        CL_MEM_READ_WRITE,
+                        sizeof(cl_float4) * nodes)}};
+
+        for (auto group = 0u; group < sources.size(); group += SOURCE_LANES) {
+            auto lanes = std::min(SOURCE_LANES, sources.size() - group);
+
+            std::vector<cl_float4> n(nodes, cl_float4{{0, 0, 0, 0}});
+            cl::copy(queue, n.begin(), n.end(), multi_storage[0]);
+
+            for (auto lane = 0u; lane != lanes; ++lane) {
+                const auto & source = sources[group + lane];
+                auto initial = initialise_mesh(source.u, source.position);
+                for (auto i = 0u; i != nodes; ++i)
+                    n[i].s[lane] = initial[i];
+            }
+            cl::copy(queue, n.begin(), n.end(), multi_storage[1]);
+
+            auto results = run_chunks<cl_float4>(
+                &multi_storage[0],
+                &multi_storage[1],
+                receivers,
+                steps,
+                [this](auto & previous, auto & current) {
+                    this->enqueue_multi_step(queue, nodes, previous, current);
+                },
+                multi_record_kernel,
+                [](auto & current) { return false; });
+
+            for (auto lane = 0u; lane != lanes; ++lane) {
+                std::vector<std::vector<cl_float>> signals(
+                    receivers.size(), std::vector<cl_float>(steps));
+                for (auto j = 0u; j != receivers.size(); ++j)
+                    for (auto i = 0u; i != steps; ++i)
+                        signals[j][i] = results[j][i].s[lane];
+                ret.push_back(signals);
+            }
+        }
 
-                return ret;
-            });
+        return ret;
+    }
 
-        std::cout << std::endl;
+    std::vector<cl_float> run(const Vec3f & e,
+                              const PowerFunction & u,
+                              size_type o,
+                              size_type steps) {
+        return run(e, u, std::vector<size_type>{o}, steps).front();
+    }
 
-        return ret;
+    std::vector<std::vector<cl_float>> run_basic(
+        const Vec3f & e,
+        const std::vector<size_type> & receivers,
+        size_type steps) {
+        auto estimated_source_index = get_index_for_coordinate(e);
+        auto source_position = get_coordinate_for_index(estimated_source_index);
+        return run(source_position, BasicPowerFunction(), receivers, steps);
     }
 
     std::vector<cl_float> run_basic(const Vec3f & e,
                                     size_type o,
-                                    size_type steps) {
-        auto estimated_source_index = get_index_for_coordinate(e);
-        auto source_position = get_coordinate_for_index(estimated_source_index);
-        return run(source_position, BasicPowerFunction(), o, steps);
+                                    size_type steps) override {
+        return run_basic(e, std::vector<size_type>{o}, steps).front();
     }
 
     std::vector<cl_float> run_inverse(const Vec3f & e,
@@ -160,45 +406,225 @@ public:
         return run(e, InverseSquarePowerFunction(power), o, steps);
     }
 
+protected:
+    const cl::Context & get_context() const {
+        return context;
+    }
+
 private:
+    /// Copy a field to the device in the format it's stored in.
+    void upload(const std::vector<cl_float> & field, cl::Buffer & buffer) {
+        if (half_fields) {
+            std::vector<cl_half> converted(field.size());
+            std::transform(
+                field.begin(), field.end(), converted.begin(), float_to_half);
+            cl::copy(queue, converted.begin(), converted.end(), buffer);
+        } else {
+            cl::copy(queue, field.begin(), field.end(), buffer);
+        }
+    }
+
+    /// Run steps in chunks, recording the receivers after every step.
+    /// U is the type of each node's value, and step enqueues a single step.
+    /// Each step in a chunk writes a row with a value per receiver, and the
+    /// whole chunk is read back at once.
+    /// After each chunk, stop is called with the latest field, and the run
+    /// ends early if it returns true.
+    /// Returns one signal per receiver.
+    template <typename U, typename Step, typename Record, typename Stop>
+    std::vector<std::vector<U>> run_chunks(
+        cl::Buffer * previous,
+        cl::Buffer * current,
+        const std::vector<size_type> & receivers,
+        size_type steps,
+        const Step & step,
+        Record & record,
+        const Stop & stop) {
+        for (auto i : receivers)
+            check_receiver(i);
+
+        std::vector<std::vector<U>> ret(receivers.size(),
+                                        std::vector<U>(steps));
+        if (receivers.empty())
+            return ret;
+
+        std::vector<cl_ulong> receiver_indices(receivers.begin(),
+                                               receivers.end());
+        cl::Buffer receiver_buffer(context,
+                                   CL_MEM_READ_ONLY,
+                                   sizeof(cl_ulong) * receiver_indices.size());
+        cl::copy(queue,
+                 receiver_indices.begin(),
+                 receiver_indices.end(),
+                 receiver_buffer);
+
+        auto chunk =
+            std::max(size_type{1}, std::min(steps, get_steps_per_sync()));
+        auto width = receivers.size();
+        cl::Buffer output(
+            context, CL_MEM_READ_WRITE, sizeof(U) * chunk * width);
+        std::vector<U> out(chunk * width);
+
+        for (size_type begin = 0; begin < steps; begin += chunk) {
+            auto end = std::min(steps, begin + chunk);
+            for (auto i = begin; i != end; ++i) {
+                step(*previous, *current);
+                record(cl::EnqueueArgs(queue, cl::NDRange(width)),
+                       *previous,
+                       receiver_buffer,
+                       output,
+                       (i - begin) * width);
+                std::swap(current, previous);
+            }
+
+            auto rows = end - begin;
+            cl::copy(queue, output, out.begin(), out.begin() + rows * width);
+            for (auto i = begin; i != end; ++i)
+                for (auto j = 0u; j != width; ++j)
+                    ret[j][i] = out[(i - begin) * width + j];
+
+            print_progress(end, steps);
+
+            if (end != steps && stop(*current)) {
+                Logger::log("stopping after ",
+                            end,
+                            " of ",
+                            steps,
+                            " steps, as the energy has decayed");
+                for (auto & i : ret)
+                    i.resize(end);
+                break;
+            }
+        }
+
+        std::cout << std::endl;
+
+        return ret;
+    }
+
     cl::CommandQueue & queue;
     kernel_type kernel;
+    record_kernel_type record_kernel;
+    record_kernel_type record_half_kernel;
+    multi_record_kernel_type multi_record_kernel;
+    energy_kernel_type energy_kernel;
+    energy_kernel_type energy_half_kernel;
     const size_type nodes;
+    const bool half_fields;
+    cl::Context context;
 
     std::array<cl::Buffer, 2> storage;
 
+    /// The work-groups get_energy reduces the field with, and the buffer it
+    /// reads their sums back from.
+    static constexpr size_type ENERGY_GROUPS = 64;
+    static constexpr size_type ENERGY_GROUP_SIZE = 128;
+    cl::Buffer partial_buffer;
+
     cl::Buffer * previous;
     cl::Buffer * current;
-
-    cl::Buffer output;
 };
 
+template <typename T>
+constexpr typename Waveguide<T>::size_type Waveguide<T>::SOURCE_LANES;
+template <typename T>
+constexpr typename Waveguide<T>::size_type Waveguide<T>::ENERGY_GROUPS;
+template <typename T>
+constexpr typename Waveguide<T>::size_type Waveguide<T>::ENERGY_GROUP_SIZE;
+
 class TetrahedralWaveguide : public Waveguide<TetrahedralProgram> {
 public:
     TetrahedralWaveguide(const TetrahedralProgram & program,
                          cl::CommandQueue & queue,
-                         const std::vector<Node> & nodes);
+                         const std::vector<Node> & nodes,
+                         bool half_fields = false);
     virtual ~TetrahedralWaveguide() noexcept = default;
 
-    cl_float run_step(size_type o,
-                      cl::CommandQueue & queue,
+    void enqueue_step(cl::CommandQueue & queue,
                       kernel_type & kernel,
                       size_type nodes,
                       cl::Buffer & previous,
-                      cl::Buffer & current,
-                      cl::Buffer & output) override;
+                      cl::Buffer & current) override;
+
+    void enqueue_multi_step(cl::CommandQueue & queue,
+                            size_type nodes,
+                            cl::Buffer & previous,
+                            cl::Buffer & current) override;
+
+    void check_receiver(size_type o) const override;
+
+    /// With the active region enabled, sorts the node lists by their
+    /// distance from the non-zero nodes in initial, so that each step can
+    /// launch over just the nodes which might have become non-zero.
+    void begin_run(const std::vector<cl_float> & initial) override;
+
+    /// Neighbour indices for each node, with -1 for neighbours which don't
+    /// exist or are outside the boundary.
+    static std::vector<cl_int4> get_ports(const std::vector<Node> & nodes);
+
+    /// The number of connections between each node and the nearest node
+    /// which is non-zero in initial, or -1 if there is no path.
+    static std::vector<cl_uint> get_distances(
+        const std::vector<cl_int4> & ports,
+        const std::vector<cl_float> & initial);
+
+    /// A node list sorted by distance, where within[d] is the number of
+    /// nodes at most d connections from the excitation.
+    /// Nodes with no path to the excitation sort last, and are never
+    /// counted in within.
+    struct ActiveList {
+        ActiveList() = default;
+        ActiveList(const std::vector<cl_uint> & list,
+                   const std::vector<cl_uint> & distances);
+
+        std::vector<cl_uint> nodes;
+        std::vector<size_type> within;
+        /// nodes on the device, filled in by begin_run.
+        cl::Buffer buffer;
+    };
 
 private:
+    /// The indices of nodes inside the boundary.
+    /// If interior is true, only nodes where every port is valid are
+    /// returned, otherwise only nodes with at least one invalid port.
+    static std::vector<cl_uint> get_node_list(
+        const std::vector<Node> & nodes,
+        const std::vector<cl_int4> & ports,
+        bool interior);
+
+    using multi_kernel_type =
+        decltype(std::declval<TetrahedralProgram>().get_multi_kernel());
+
+    kernel_type interior_kernel;
+    kernel_type half_kernel;
+    kernel_type interior_half_kernel;
+    multi_kernel_type multi_kernel;
     std::vector<Node> nodes;
-    cl::Buffer node_buffer;
+    std::vector<cl_int4> ports;
+    std::vector<cl_uint> interior;
+    std::vector<cl_uint> boundary;
+    cl::Buffer port_buffer;
+    cl::Buffer interior_buffer;
+    cl::Buffer boundary_buffer;
+
+    /// The steps taken since begin_run, and whether the active lists are
+    /// still in use.
+    size_type step{0};
+    bool active{false};
+    ActiveList active_interior;
+    ActiveList active_boundary;
 };
 
 class IterativeTetrahedralWaveguide : public TetrahedralWaveguide {
 public:
+    /// With half_fields, the pressure fields are stored as half precision,
+    /// which saves memory and bandwidth at the cost of accuracy.
     IterativeTetrahedralWaveguide(const TetrahedralProgram & program,
                                   cl::CommandQueue & queue,
                                   const Boundary & boundary,
-                                  float cube_side);
+                                  float cube_side,
+                                  bool morton_order = false,
+                                  bool half_fields = false);
     virtual ~IterativeTetrahedralWaveguide() noexcept = default;
 
     size_type get_index_for_coordinate(const Vec3f & v) const override;
@@ -207,6 +633,87 @@ public:
 private:
     IterativeTetrahedralWaveguide(const TetrahedralProgram & program,
                                   cl::CommandQueue & queue,
-                                  const IterativeTetrahedralMesh & mesh);
+                                  const IterativeTetrahedralMesh & mesh,
+                                  bool half_fields);
+    IterativeTetrahedralMesh mesh;
+};
+
+/// A tetrahedral waveguide which stores no connectivity on the device.
+/// The kernel runs over the full grid covering the bounding box of the
+/// boundary, and computes the neighbours of each node from its index.
+/// Device memory is just the two pressure fields plus one bit per node, so
+/// this fits larger rooms than IterativeTetrahedralWaveguide unless the room
+/// fills only a small part of its bounding box.
+/// Indices are full-grid indices rather than indices into mesh.nodes.
+class ImplicitTetrahedralWaveguide : public Waveguide<TetrahedralProgram> {
+public:
+    ImplicitTetrahedralWaveguide(const TetrahedralProgram & program,
+                                 cl::CommandQueue & queue,
+                                 const Boundary & boundary,
+                                 float cube_side);
+    virtual ~ImplicitTetrahedralWaveguide() noexcept = default;
+
+    /// Uses the implicit kernel from the program rather than kernel.
+    void enqueue_step(cl::CommandQueue & queue,
+                      kernel_type & kernel,
+                      size_type nodes,
+                      cl::Buffer & previous,
+                      cl::Buffer & current) override;
+
+    void check_receiver(size_type o) const override;
+
+    size_type get_index_for_coordinate(const Vec3f & v) const override;
+    Vec3f get_coordinate_for_index(size_type index) const override;
+
+private:
+    using implicit_kernel_type =
+        decltype(std::declval<TetrahedralProgram>().get_implicit_kernel());
+
+    ImplicitTetrahedralWaveguide(const TetrahedralProgram & program,
+                                 cl::CommandQueue & queue,
+                                 const IterativeTetrahedralMesh & mesh);
+
+    static std::vector<cl_uint> get_inside_mask(
+        const IterativeTetrahedralMesh & mesh);
+
     IterativeTetrahedralMesh mesh;
+    implicit_kernel_type implicit_kernel;
+    std::vector<cl_uint> inside_mask;
+    cl::Buffer inside_buffer;
+};
+
+/// A waveguide on a rectilinear grid, where each node has six neighbours
+/// along the axes.
+/// Neighbours are found from the node index, so the device only stores the
+/// pressure fields and an inside bit per node.
+class RectilinearWaveguide : public Waveguide<RectilinearProgram> {
+public:
+    /// With half_fields, the pressure fields are stored as half precision.
+    RectilinearWaveguide(const RectilinearProgram & program,
+                         cl::CommandQueue & queue,
+                         const Boundary & boundary,
+                         float spacing,
+                         bool half_fields = false);
+    virtual ~RectilinearWaveguide() noexcept = default;
+
+    void enqueue_step(cl::CommandQueue & queue,
+                      kernel_type & kernel,
+                      size_type nodes,
+                      cl::Buffer & previous,
+                      cl::Buffer & current) override;
+
+    void check_receiver(size_type o) const override;
+
+    size_type get_index_for_coordinate(const Vec3f & v) const override;
+    Vec3f get_coordinate_for_index(size_type index) const override;
+
+private:
+    RectilinearWaveguide(const RectilinearProgram & program,
+                         cl::CommandQueue & queue,
+                         const RectilinearMesh & mesh,
+                         bool half_fields);
+
+    RectilinearMesh mesh;
+    kernel_type half_kernel;
+    cl::Buffer inside_buffer;
 };
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+
+//  Kernels which don't depend on the mesh, as both waveguides store one
+//  value per node.
+//  TetrahedralProgram and RectilinearProgram prepend this to their own
+//  source.
+static const std::string waveguide_kernel_source{R"(
+    //  inside holds one bit per node in the full grid.
+    bool is_inside(global uint * inside, size_t index) {
+        return inside[index / 32] & (1u << (index % 32));
+    }
+
+    //  Copy the value of each receiver node into a row of output, so that
+    //  many steps can be run before the host reads the output.
+    kernel void record_receivers
+    (   global float * values
+    ,   global unsigned long * receivers
+    ,   global float * output
+    ,   unsigned long output_offset
+    ) {
+        size_t index = get_global_id(0);
+        output[output_offset + index] = values[receivers[index]];
+    }
+
+    kernel void record_receivers_multi
+    (   global float4 * values
+    ,   global unsigned long * receivers
+    ,   global float4 * output
+    ,   unsigned long output_offset
+    ) {
+        size_t index = get_global_id(0);
+        output[output_offset + index] = values[receivers[index]];
+    }
+
+    kernel void record_receivers_half
+    (   global half * values
+    ,   global unsigned long * receivers
+    ,   global float * output
+    ,   unsigned long output_offset
+    ) {
+        size_t index = get_global_id(0);
+        output[output_offset + index] = vload_half(receivers[index], values);
+    }
+
+    kernel void energy
+    (   global float * values
+    ,   unsigned long nodes
+    ,   local float * scratch
+    ,   global float * partial
+    ) {
+        size_t local_index = get_local_id(0);
+        float sum = 0;
+        for (size_t i = get_global_id(0); i < nodes; i += get_global_size(0)) {
+            float value = values[i];
+            sum += value * value;
+        }
+        scratch[local_index] = sum;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        //  the local size is a power of two
+        for (size_t s = get_local_size(0) / 2; s != 0; s /= 2) {
+            if (local_index < s)
+                scratch[local_index] += scratch[local_index + s];
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        if (local_index == 0)
+            partial[get_group_id(0)] = scratch[0];
+    }
+
+    kernel void energy_half
+    (   global half * values
+    ,   unsigned long nodes
+    ,   local float * scratch
+    ,   global float * partial
+    ) {
+        size_t local_index = get_local_id(0);
+        float sum = 0;
+        for (size_t i = get_global_id(0); i < nodes; i += get_global_size(0)) {
+            float value = vload_half(i, values);
+            sum += value * value;
+        }
+        scratch[local_index] = sum;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (size_t s = get_local_size(0) / 2; s != 0; s /= 2) {
+            if (local_index < s)
+                scratch[local_index] += scratch[local_index + s];
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        if (local_index == 0)
+            partial[get_group_id(0)] = scratch[0];
+    }
+)"};
@@ -31,3 +31,52 @@ typedef struct {
     cl_float3 direction;
     cl_float coefficient;
 } __attribute__((aligned(8))) Speaker;
+
+/// The state of a ray in between reflections, used when tracing one reflection
+/// at a time.
+typedef struct {
+    VolumeType volume;
+    cl_float3 position;
+    cl_float3 direction;
+    cl_float3 mic_reflection;
+    cl_float distance;
+    cl_ulong ray_index;
+    cl_int active;
+} __attribute__((aligned(8))) RayState;
+
+/// Used to sort rays by direction and position.
+typedef struct {
+    cl_uint key;
+    cl_uint index;
+} __attribute__((aligned(8))) RayKey;
+
+typedef struct {
+    cl_float3 v0;
+    cl_float3 v1;
+    cl_float3 v2;
+} __attribute__((aligned(8))) TriangleVerts;
+
+/// The range of triangles in the simplified-scene buffer which should be used
+/// for a particular reflection.
+/// A range with no triangles means that the full scene should be used.
+typedef struct {
+    cl_ulong triangle_offset;
+    cl_ulong numtriangles;
+} __attribute__((aligned(8))) LodRange;
+
+/// Describes a single job in a batched raytrace.
+typedef struct {
+    cl_float3 position;
+    cl_float3 source;
+    cl_ulong triangle_offset;
+    cl_ulong numtriangles;
+} __attribute__((aligned(8))) BatchJob;
+
+/// A node in the tree of image sources.
+/// The root node is the source itself, with no parent or triangle.
+typedef struct {
+    cl_float3 image;
+    cl_uint parent;
+    cl_uint triangle;
+    cl_uint order;
+} __attribute__((aligned(8))) ImageSourceNode;
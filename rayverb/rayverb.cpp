@@ -170,6 +170,37 @@ bool inside(const pair<cl_float3, cl_float3> & bounds,
     return true;
 }
 
+/// Per-band absorption coefficients for sound travelling through air.
+static const VolumeType AIR_COEFFICIENT{{0.001 * -0.1,
+                                         0.001 * -0.2,
+                                         0.001 * -0.5,
+                                         0.001 * -1.1,
+                                         0.001 * -2.7,
+                                         0.001 * -9.4,
+                                         0.001 * -29.0,
+                                         0.001 * -60.0}};
+
+/// Add the image-source contributions found by a group of rays to a tally,
+/// removing duplicate contributions.
+static void tallyImageSources(map<vector<unsigned long>, Impulse> & tally,
+                              const unsigned long * image_source_index,
+                              const Impulse * image,
+                              unsigned long nrays) {
+    for (auto j = 0u; j != nrays * NUM_IMAGE_SOURCE; j += NUM_IMAGE_SOURCE) {
+        for (auto k = 1; k != NUM_IMAGE_SOURCE + 1; ++k) {
+            vector<unsigned long> surfaces(image_source_index + j,
+                                           image_source_index + j + k);
+
+            if (k == 1 || surfaces.back() != 0) {
+                auto it = tally.find(surfaces);
+                if (it == tally.end()) {
+                    tally[surfaces] = image[j + k - 1];
+                }
+            }
+        }
+    }
+}
+
 /// Reserve graphics memory.
 Raytrace::Raytrace(const RayverbProgram & program,
                    cl::CommandQueue & queue,
@@ -179,8 +210,22 @@ Raytrace::Raytrace(const RayverbProgram & program,
                    vector<Surface> & surfaces)
         : queue(queue)
         , kernel(program.get_raytrace_kernel())
+        , raytrace_local_kernel(program.get_raytrace_local_kernel())
+        , init_rays_kernel(program.get_init_rays_kernel())
+        , raytrace_step_kernel(program.get_raytrace_step_kernel())
+        , receiver_visibility_map_kernel(
+              program.get_receiver_visibility_map_kernel())
+        , image_source_count_kernel(program.get_image_source_count_kernel())
+        , image_source_expand_kernel(program.get_image_source_expand_kernel())
+        , image_source_validate_kernel(
+              program.get_image_source_validate_kernel())
+        , ray_keys_kernel(program.get_ray_keys_kernel())
+        , sort_ray_keys_kernel(program.get_sort_ray_keys_kernel())
+        , permute_rays_kernel(program.get_permute_rays_kernel())
         , nreflections(nreflections)
         , ntriangles(triangles.size())
+        , nvertices(vertices.size())
+        , nsurfaces(surfaces.size())
         , cl_directions(program.getInfo<CL_PROGRAM_CONTEXT>(),
                         CL_MEM_READ_WRITE,
                         RAY_GROUP_SIZE * sizeof(cl_float3))
@@ -206,7 +251,37 @@ Raytrace::Raytrace(const RayverbProgram & program,
               program.getInfo<CL_PROGRAM_CONTEXT>(),
               CL_MEM_READ_WRITE,
               RAY_GROUP_SIZE * NUM_IMAGE_SOURCE * sizeof(cl_ulong))
-        , bounds(getBounds(vertices)) {
+        , cl_ray_states({{cl::Buffer(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                                     CL_MEM_READ_WRITE,
+                                     RAY_GROUP_SIZE * sizeof(RayState)),
+                          cl::Buffer(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                                     CL_MEM_READ_WRITE,
+                                     RAY_GROUP_SIZE * sizeof(RayState))}})
+        , cl_ray_keys(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                      CL_MEM_READ_WRITE,
+                      RAY_GROUP_SIZE * sizeof(RayKey))
+        , cl_ray_primitives(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                            CL_MEM_READ_WRITE,
+                            RAY_GROUP_SIZE * (NUM_IMAGE_SOURCE - 1) *
+                                sizeof(TriangleVerts))
+        , cl_receiver_visibility(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                                 CL_MEM_READ_WRITE,
+                                 sizeof(cl_uchar))
+        , cl_lod_triangles(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                           CL_MEM_READ_WRITE,
+                           sizeof(Triangle))
+        , cl_lod_vertices(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                          CL_MEM_READ_WRITE,
+                          sizeof(cl_float3))
+        , cl_lod_ranges(program.getInfo<CL_PROGRAM_CONTEXT>(),
+                        CL_MEM_READ_WRITE,
+                        nreflections * sizeof(LodRange))
+        , scene_vertices(vertices)
+        , bounds(getBounds(vertices))
+        , use_local_memory(sceneFitsLocalMemory()) {
+    static_assert((RAY_GROUP_SIZE & (RAY_GROUP_SIZE - 1)) == 0,
+                  "ray sorting requires a power-of-two ray group size");
+    setLevelsOfDetail(vector<LevelOfDetail>());
 }
 
 Raytrace::Raytrace(const RayverbProgram & program,
@@ -259,7 +334,15 @@ void Raytrace::raytrace(const cl_float3 & micpos,
         }
     }
 
+    if (visibility_resolution &&
+        receiver_model.mode == ReceiverModel::DIFFUSE_RAIN) {
+        prepareVisibilityMap(micpos);
+    }
+
     imageSourceTally.clear();
+    if (image_source_order)
+        findImageSources(micpos, source);
+
     storedDiffuse.resize(directions.size() * nreflections);
     for (auto i = 0u; i != ceil(directions.size() / float(RAY_GROUP_SIZE));
          ++i) {
@@ -284,59 +367,77 @@ void Raytrace::raytrace(const cl_float3 & micpos,
         vector<Impulse> image(
             RAY_GROUP_SIZE * NUM_IMAGE_SOURCE,
             Impulse{{{0, 0, 0, 0, 0, 0, 0, 0}}, {{0, 0, 0}}, 0});
-        cl::copy(queue, begin(image), end(image), cl_image_source);
-
         vector<unsigned long> image_source_index(
             RAY_GROUP_SIZE * NUM_IMAGE_SOURCE, 0);
-        cl::copy(queue,
-                 begin(image_source_index),
-                 end(image_source_index),
-                 cl_image_source_index);
+        if (!image_source_order) {
+            cl::copy(queue, begin(image), end(image), cl_image_source);
+            cl::copy(queue,
+                     begin(image_source_index),
+                     end(image_source_index),
+                     cl_image_source_index);
+        }
 
         //  run kernel
-        kernel(cl::EnqueueArgs(queue, cl::NDRange(RAY_GROUP_SIZE)),
-               cl_directions,
-               micpos,
-               cl_triangles,
-               ntriangles,
-               cl_vertices,
-               source,
-               cl_surfaces,
-               cl_impulses,
-               cl_image_source,
-               cl_image_source_index,
-               nreflections,
-               (VolumeType){{0.001 * -0.1,
-                             0.001 * -0.2,
-                             0.001 * -0.5,
-                             0.001 * -1.1,
-                             0.001 * -2.7,
-                             0.001 * -9.4,
-                             0.001 * -29.0,
-                             0.001 * -60.0}});
+        if (sort_rays) {
+            raytraceSorted(micpos, source);
+        } else if (use_local_memory) {
+            raytrace_local_kernel(
+                cl::EnqueueArgs(queue, cl::NDRange(RAY_GROUP_SIZE)),
+                cl_directions,
+                micpos,
+                cl_triangles,
+                ntriangles,
+                cl_vertices,
+                nvertices,
+                cl::Local(ntriangles * sizeof(Triangle)),
+                cl::Local(nvertices * sizeof(cl_float3)),
+                cl_lod_triangles,
+                cl_lod_vertices,
+                cl_lod_ranges,
+                source,
+                cl_surfaces,
+                cl_impulses,
+                rayImageSource(),
+                rayImageSourceIndex(),
+                nreflections,
+                AIR_COEFFICIENT,
+                receiverRadius(),
+                cl_receiver_visibility,
+                visibility_resolution);
+        } else {
+            kernel(cl::EnqueueArgs(queue, cl::NDRange(RAY_GROUP_SIZE)),
+                   cl_directions,
+                   micpos,
+                   cl_triangles,
+                   ntriangles,
+                   cl_vertices,
+                   cl_lod_triangles,
+                   cl_lod_vertices,
+                   cl_lod_ranges,
+                   source,
+                   cl_surfaces,
+                   cl_impulses,
+                   rayImageSource(),
+                   rayImageSourceIndex(),
+                   nreflections,
+                   AIR_COEFFICIENT,
+                   receiverRadius(),
+                   cl_receiver_visibility,
+                   visibility_resolution);
+        }
 
         //  copy output to main memory
-        cl::copy(queue,
-                 cl_image_source_index,
-                 begin(image_source_index),
-                 end(image_source_index));
-        cl::copy(queue, cl_image_source, begin(image), end(image));
-
-        //  remove duplicate image-source contributions
-        for (auto j = 0; j != RAY_GROUP_SIZE * NUM_IMAGE_SOURCE;
-             j += NUM_IMAGE_SOURCE) {
-            for (auto k = 1; k != NUM_IMAGE_SOURCE + 1; ++k) {
-                vector<unsigned long> surfaces(
-                    image_source_index.begin() + j,
-                    image_source_index.begin() + j + k);
-
-                if (k == 1 || surfaces.back() != 0) {
-                    auto it = imageSourceTally.find(surfaces);
-                    if (it == imageSourceTally.end()) {
-                        imageSourceTally[surfaces] = image[j + k - 1];
-                    }
-                }
-            }
+        if (!image_source_order) {
+            cl::copy(queue,
+                     cl_image_source_index,
+                     begin(image_source_index),
+                     end(image_source_index));
+            cl::copy(queue, cl_image_source, begin(image), end(image));
+
+            tallyImageSources(imageSourceTally,
+                              image_source_index.data(),
+                              image.data(),
+                              RAY_GROUP_SIZE);
         }
 
         cl::copy(queue,
@@ -361,6 +462,352 @@ void Raytrace::raytrace(const cl_float3 & micpos,
 #endif
 }
 
+void Raytrace::raytraceSorted(const cl_float3 & micpos,
+                              const cl_float3 & source) {
+    init_rays_kernel(cl::EnqueueArgs(queue, cl::NDRange(RAY_GROUP_SIZE)),
+                     cl_directions,
+                     micpos,
+                     cl_triangles,
+                     ntriangles,
+                     cl_vertices,
+                     source,
+                     rayImageSource(),
+                     rayImageSourceIndex(),
+                     cl_ray_states[0],
+                     AIR_COEFFICIENT);
+
+    for (auto i = 0u; i != nreflections; ++i) {
+        reorderRays();
+        raytrace_step_kernel(
+            cl::EnqueueArgs(queue, cl::NDRange(RAY_GROUP_SIZE)),
+            cl_ray_states[0],
+            cl_ray_primitives,
+            i,
+            micpos,
+            cl_triangles,
+            ntriangles,
+            cl_vertices,
+            cl_lod_triangles,
+            cl_lod_vertices,
+            cl_lod_ranges,
+            source,
+            cl_surfaces,
+            cl_impulses,
+            rayImageSource(),
+            rayImageSourceIndex(),
+            nreflections,
+            AIR_COEFFICIENT,
+            receiverRadius(),
+            cl_receiver_visibility,
+            visibility_resolution);
+    }
+}
+
+void Raytrace::reorderRays() {
+    ray_keys_kernel(cl::EnqueueArgs(queue, cl::NDRange(RAY_GROUP_SIZE)),
+                    cl_ray_states[0],
+                    cl_ray_keys,
+                    bounds.first,
+                    bounds.second);
+
+    //  bitonic sort of the keys
+    for (cl_uint k = 2; k <= RAY_GROUP_SIZE; k <<= 1) {
+        for (cl_uint j = k >> 1; j > 0; j >>= 1) {
+            sort_ray_keys_kernel(
+                cl::EnqueueArgs(queue, cl::NDRange(RAY_GROUP_SIZE)),
+                cl_ray_keys,
+                j,
+                k);
+        }
+    }
+
+    permute_rays_kernel(cl::EnqueueArgs(queue, cl::NDRange(RAY_GROUP_SIZE)),
+                        cl_ray_states[0],
+                        cl_ray_keys,
+                        cl_ray_states[1]);
+
+    swap(cl_ray_states[0], cl_ray_states[1]);
+}
+
+size_t Raytrace::localMemoryRequired() const {
+    return ntriangles * sizeof(Triangle) + nvertices * sizeof(cl_float3);
+}
+
+bool Raytrace::sceneFitsLocalMemory() const {
+    auto device = queue.getInfo<CL_QUEUE_DEVICE>();
+    return localMemoryRequired() <=
+           device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+}
+
+void Raytrace::setUseLocalMemory(bool b) {
+    if (b && !sceneFitsLocalMemory())
+        throw runtime_error("scene is too large to fit in local memory");
+    use_local_memory = b;
+}
+
+bool Raytrace::getUseLocalMemory() const {
+    return use_local_memory;
+}
+
+cl_float Raytrace::receiverRadius() const {
+    return receiver_model.mode == ReceiverModel::SPHERE ? receiver_model.radius
+                                                        : 0;
+}
+
+void Raytrace::setReceiverModel(const ReceiverModel & model) {
+    if (model.mode == ReceiverModel::SPHERE && !(0 < model.radius))
+        throw runtime_error("receiver sphere must have a positive radius");
+    receiver_model = model;
+}
+
+ReceiverModel Raytrace::getReceiverModel() const {
+    return receiver_model;
+}
+
+void Raytrace::setVisibilityMapResolution(cl_uint resolution) {
+    if (resolution != visibility_resolution)
+        visibility_map_valid = false;
+    visibility_resolution = resolution;
+}
+
+cl_uint Raytrace::getVisibilityMapResolution() const {
+    return visibility_resolution;
+}
+
+void Raytrace::prepareVisibilityMap(const cl_float3 & micpos) {
+    if (!visibility_resolution)
+        return;
+
+    if (hasVisibilityMap(micpos))
+        return;
+
+    auto cells = ntriangles * visibility_resolution * visibility_resolution;
+    cl_receiver_visibility =
+        cl::Buffer(queue.getInfo<CL_QUEUE_CONTEXT>(),
+                   CL_MEM_READ_WRITE,
+                   cells * sizeof(cl_uchar));
+
+    receiver_visibility_map_kernel(
+        cl::EnqueueArgs(queue, cl::NDRange(cells)),
+        micpos,
+        cl_triangles,
+        ntriangles,
+        cl_vertices,
+        cl_receiver_visibility,
+        visibility_resolution);
+
+    visibility_map_micpos = micpos;
+    visibility_map_valid = true;
+}
+
+bool Raytrace::hasVisibilityMap(const cl_float3 & micpos) const {
+    return visibility_map_valid && visibility_map_micpos.x == micpos.x &&
+           visibility_map_micpos.y == micpos.y &&
+           visibility_map_micpos.z == micpos.z;
+}
+
+void Raytrace::setLevelsOfDetail(const vector<LevelOfDetail> & levels) {
+    //  concatenate the levels, offsetting vertex indices so that each
+    //  triangle refers to its own level's vertices
+    vector<Triangle> triangles;
+    vector<cl_float3> vertices;
+    vector<LodRange> ranges(nreflections, LodRange{0, 0});
+    unsigned long previous_order = 0;
+    for (const auto & level : levels) {
+        auto first_order =
+            max(level.first_order, (unsigned long)NUM_IMAGE_SOURCE - 1);
+        if (first_order < previous_order)
+            throw runtime_error("levels of detail must be in order");
+        previous_order = first_order;
+
+        if (level.scene.triangles.empty())
+            throw runtime_error("level of detail has no triangles");
+
+        LodRange range{triangles.size(), level.scene.triangles.size()};
+        for (auto i = first_order; i < nreflections; ++i)
+            ranges[i] = range;
+
+        for (auto t : level.scene.triangles) {
+            t.v0 += vertices.size();
+            t.v1 += vertices.size();
+            t.v2 += vertices.size();
+            triangles.push_back(t);
+        }
+        vertices.insert(vertices.end(),
+                        level.scene.vertices.begin(),
+                        level.scene.vertices.end());
+    }
+
+    auto context = queue.getInfo<CL_QUEUE_CONTEXT>();
+    if (!triangles.empty()) {
+        cl_lod_triangles =
+            cl::Buffer(context, begin(triangles), end(triangles), true);
+        cl_lod_vertices =
+            cl::Buffer(context, begin(vertices), end(vertices), true);
+    }
+    cl::copy(queue, begin(ranges), end(ranges), cl_lod_ranges);
+}
+
+void Raytrace::updateVertices(cl_ulong first,
+                              const vector<cl_float3> & vertices) {
+    if (nvertices < first + vertices.size())
+        throw runtime_error("vertex update is out of range");
+    if (vertices.empty())
+        return;
+
+    queue.enqueueWriteBuffer(cl_vertices,
+                             CL_TRUE,
+                             first * sizeof(cl_float3),
+                             vertices.size() * sizeof(cl_float3),
+                             vertices.data());
+
+    copy(vertices.begin(), vertices.end(), scene_vertices.begin() + first);
+    bounds = getBounds(scene_vertices);
+
+    visibility_map_valid = false;
+    setLevelsOfDetail(vector<LevelOfDetail>());
+}
+
+void Raytrace::updateSurfaces(cl_ulong first,
+                              const vector<Surface> & surfaces) {
+    if (nsurfaces < first + surfaces.size())
+        throw runtime_error("surface update is out of range");
+    if (surfaces.empty())
+        return;
+
+    queue.enqueueWriteBuffer(cl_surfaces,
+                             CL_TRUE,
+                             first * sizeof(Surface),
+                             surfaces.size() * sizeof(Surface),
+                             surfaces.data());
+}
+
+cl::Buffer Raytrace::rayImageSource() const {
+    return image_source_order ? cl::Buffer() : cl_image_source;
+}
+
+cl::Buffer Raytrace::rayImageSourceIndex() const {
+    return image_source_order ? cl::Buffer() : cl_image_source_index;
+}
+
+void Raytrace::setImageSourceOrder(unsigned long order) {
+    if (NUM_IMAGE_SOURCE - 1 < order)
+        throw runtime_error("image source order is too high");
+    image_source_order = order;
+}
+
+unsigned long Raytrace::getImageSourceOrder() const {
+    return image_source_order;
+}
+
+void Raytrace::findImageSources(const cl_float3 & micpos,
+                                const cl_float3 & source) {
+    auto context = queue.getInfo<CL_QUEUE_CONTEXT>();
+    cl::Buffer cl_nodes(context,
+                        CL_MEM_READ_WRITE,
+                        IMAGE_SOURCE_CAPACITY * sizeof(ImageSourceNode));
+
+    //  the root of the tree is the source itself
+    ImageSourceNode root{source, 0, numeric_limits<cl_uint>::max(), 0};
+    queue.enqueueWriteBuffer(
+        cl_nodes, CL_TRUE, 0, sizeof(ImageSourceNode), &root);
+
+    //  expand the tree one order at a time
+    //  each parent's children go in a range found by a prefix sum of the
+    //  child counts, in triangle order, so the tree is the same on every
+    //  run, and if it has to be truncated the same nodes are dropped
+    cl_uint parent_begin = 0;
+    cl_uint parent_count = 1;
+    for (auto order = 0u; order != image_source_order; ++order) {
+        cl_uint child_begin = parent_begin + parent_count;
+        cl::Buffer cl_offsets(
+            context, CL_MEM_READ_WRITE, parent_count * sizeof(cl_uint));
+
+        image_source_count_kernel(
+            cl::EnqueueArgs(queue, cl::NDRange(parent_count)),
+            cl_nodes,
+            parent_begin,
+            cl_triangles,
+            ntriangles,
+            cl_vertices,
+            cl_offsets);
+
+        vector<cl_uint> offsets(parent_count);
+        cl::copy(queue, cl_offsets, begin(offsets), end(offsets));
+        cl_ulong children = 0;
+        for (auto & i : offsets) {
+            auto count = i;
+            i = min(children, cl_ulong{IMAGE_SOURCE_CAPACITY});
+            children += count;
+        }
+        cl::copy(queue, begin(offsets), end(offsets), cl_offsets);
+
+        image_source_expand_kernel(
+            cl::EnqueueArgs(queue, cl::NDRange(parent_count)),
+            cl_nodes,
+            parent_begin,
+            child_begin,
+            cl_triangles,
+            ntriangles,
+            cl_vertices,
+            cl_offsets,
+            IMAGE_SOURCE_CAPACITY - child_begin);
+
+        if (IMAGE_SOURCE_CAPACITY - child_begin < children) {
+            Logger::log_err("image-source tree truncated at order ",
+                            order + 1);
+            children = IMAGE_SOURCE_CAPACITY - child_begin;
+        }
+
+        parent_begin = child_begin;
+        parent_count = children;
+        if (!parent_count)
+            break;
+    }
+
+    //  validate the path from every node to the mic
+    auto nnodes = parent_begin + parent_count;
+    cl::Buffer cl_images(context, CL_MEM_READ_WRITE, nnodes * sizeof(Impulse));
+    cl::Buffer cl_paths(context,
+                        CL_MEM_READ_WRITE,
+                        nnodes * NUM_IMAGE_SOURCE * sizeof(cl_ulong));
+    vector<cl_ulong> paths(nnodes * NUM_IMAGE_SOURCE, 0);
+    cl::copy(queue, begin(paths), end(paths), cl_paths);
+
+    image_source_validate_kernel(cl::EnqueueArgs(queue, cl::NDRange(nnodes)),
+                                 cl_nodes,
+                                 micpos,
+                                 cl_triangles,
+                                 ntriangles,
+                                 cl_vertices,
+                                 cl_surfaces,
+                                 cl_images,
+                                 cl_paths,
+                                 AIR_COEFFICIENT);
+
+    vector<ImageSourceNode> nodes(nnodes);
+    vector<Impulse> images(nnodes);
+    cl::copy(queue, cl_nodes, begin(nodes), end(nodes));
+    cl::copy(queue, cl_images, begin(images), end(images));
+    cl::copy(queue, cl_paths, begin(paths), end(paths));
+
+    for (auto i = 0u; i != nnodes; ++i) {
+        auto path = paths.begin() + i * NUM_IMAGE_SOURCE;
+        if (path[0] == 0) {
+            vector<unsigned long> surfaces(path, path + nodes[i].order + 1);
+            imageSourceTally.emplace(surfaces, images[i]);
+        }
+    }
+}
+
+void Raytrace::setSortRays(bool b) {
+    sort_rays = b;
+}
+
+bool Raytrace::getSortRays() const {
+    return sort_rays;
+}
+
 RaytracerResults Raytrace::getRawDiffuse() {
     return RaytracerResults(storedDiffuse, storedMicpos);
 }
@@ -385,6 +832,158 @@ RaytracerResults Raytrace::getAllRaw(bool removeDirect) {
     return RaytracerResults(diffuse, storedMicpos);
 }
 
+BatchRaytrace::BatchRaytrace(const RayverbProgram & program,
+                             cl::CommandQueue & queue,
+                             unsigned long nreflections,
+                             const vector<SceneData> & scenes)
+        : queue(queue)
+        , kernel(program.get_raytrace_batch_kernel())
+        , nreflections(nreflections) {
+    if (scenes.empty())
+        throw runtime_error("batch raytrace requires at least one scene");
+
+    //  concatenate the scenes, offsetting vertex and surface indices so that
+    //  each triangle refers to its own scene's vertices and surfaces
+    vector<Triangle> triangles;
+    vector<cl_float3> vertices;
+    vector<Surface> surfaces;
+    for (const auto & scene : scenes) {
+        scene_triangles.emplace_back(triangles.size(), scene.triangles.size());
+
+        const auto vertex_offset = vertices.size();
+        const auto surface_offset = surfaces.size();
+        for (auto t : scene.triangles) {
+            t.surface += surface_offset;
+            t.v0 += vertex_offset;
+            t.v1 += vertex_offset;
+            t.v2 += vertex_offset;
+            triangles.push_back(t);
+        }
+        vertices.insert(
+            vertices.end(), scene.vertices.begin(), scene.vertices.end());
+        surfaces.insert(
+            surfaces.end(), scene.surfaces.begin(), scene.surfaces.end());
+    }
+
+    auto context = program.getInfo<CL_PROGRAM_CONTEXT>();
+    cl_triangles = cl::Buffer(context, begin(triangles), end(triangles), true);
+    cl_vertices = cl::Buffer(context, begin(vertices), end(vertices), true);
+    cl_surfaces = cl::Buffer(context, begin(surfaces), end(surfaces), true);
+}
+
+void BatchRaytrace::raytrace(const vector<Job> & jobs,
+                             const vector<cl_float3> & directions) {
+    vector<BatchJob> batch;
+    storedMicpos.clear();
+    for (const auto & job : jobs) {
+        if (job.scene >= scene_triangles.size())
+            throw runtime_error("batch job refers to a nonexistent scene");
+        const auto & range = scene_triangles[job.scene];
+        batch.push_back(
+            BatchJob{job.mic, job.source, range.first, range.second});
+        storedMicpos.push_back(job.mic);
+    }
+
+    storedDiffuse.assign(jobs.size(),
+                         vector<Impulse>(directions.size() * nreflections));
+    imageSourceTally.assign(jobs.size(), {});
+
+    if (jobs.empty())
+        return;
+
+    auto context = queue.getInfo<CL_QUEUE_CONTEXT>();
+    cl::Buffer cl_jobs(context, begin(batch), end(batch), true);
+    cl::Buffer cl_directions(
+        context, CL_MEM_READ_WRITE, RAY_GROUP_SIZE * sizeof(cl_float3));
+    cl::Buffer cl_impulses(
+        context,
+        CL_MEM_READ_WRITE,
+        jobs.size() * RAY_GROUP_SIZE * nreflections * sizeof(Impulse));
+    cl::Buffer cl_image_source(
+        context,
+        CL_MEM_READ_WRITE,
+        jobs.size() * RAY_GROUP_SIZE * NUM_IMAGE_SOURCE * sizeof(Impulse));
+    cl::Buffer cl_image_source_index(
+        context,
+        CL_MEM_READ_WRITE,
+        jobs.size() * RAY_GROUP_SIZE * NUM_IMAGE_SOURCE * sizeof(cl_ulong));
+
+    for (auto b = 0ul; b < directions.size(); b += RAY_GROUP_SIZE) {
+        auto e = min(directions.size(), b + RAY_GROUP_SIZE);
+        auto nrays = e - b;
+
+        cl::copy(queue,
+                 directions.begin() + b,
+                 directions.begin() + e,
+                 cl_directions);
+
+        //  zero out impulse storage memory
+        vector<Impulse> diffuse(
+            jobs.size() * nrays * nreflections,
+            Impulse{{{0, 0, 0, 0, 0, 0, 0, 0}}, {{0, 0, 0}}, 0});
+        cl::copy(queue, begin(diffuse), end(diffuse), cl_impulses);
+
+        vector<Impulse> image(
+            jobs.size() * nrays * NUM_IMAGE_SOURCE,
+            Impulse{{{0, 0, 0, 0, 0, 0, 0, 0}}, {{0, 0, 0}}, 0});
+        cl::copy(queue, begin(image), end(image), cl_image_source);
+
+        vector<unsigned long> image_source_index(
+            jobs.size() * nrays * NUM_IMAGE_SOURCE, 0);
+        cl::copy(queue,
+                 begin(image_source_index),
+                 end(image_source_index),
+                 cl_image_source_index);
+
+        kernel(cl::EnqueueArgs(queue, cl::NDRange(nrays, jobs.size())),
+               cl_directions,
+               cl_jobs,
+               cl_triangles,
+               cl_vertices,
+               cl_surfaces,
+               cl_impulses,
+               cl_image_source,
+               cl_image_source_index,
+               nreflections,
+               AIR_COEFFICIENT);
+
+        //  copy output to main memory
+        cl::copy(queue,
+                 cl_image_source_index,
+                 begin(image_source_index),
+                 end(image_source_index));
+        cl::copy(queue, cl_image_source, begin(image), end(image));
+        cl::copy(queue, cl_impulses, begin(diffuse), end(diffuse));
+
+        //  split the output between jobs
+        for (auto j = 0u; j != jobs.size(); ++j) {
+            tallyImageSources(
+                imageSourceTally[j],
+                image_source_index.data() + j * nrays * NUM_IMAGE_SOURCE,
+                image.data() + j * nrays * NUM_IMAGE_SOURCE,
+                nrays);
+
+            auto job_diffuse = diffuse.begin() + j * nrays * nreflections;
+            copy(job_diffuse,
+                 job_diffuse + nrays * nreflections,
+                 storedDiffuse[j].begin() + b * nreflections);
+        }
+    }
+}
+
+vector<RaytracerResults> BatchRaytrace::getAllRaw(bool removeDirect) {
+    vector<RaytracerResults> ret;
+    for (auto j = 0u; j != storedDiffuse.size(); ++j) {
+        auto impulses = storedDiffuse[j];
+        for (const auto & i : imageSourceTally[j]) {
+            if (!(removeDirect && i.first == vector<unsigned long>{0}))
+                impulses.push_back(i.second);
+        }
+        ret.emplace_back(impulses, storedMicpos[j]);
+    }
+    return ret;
+}
+
 Hrtf::Hrtf(const RayverbProgram & program, cl::CommandQueue & queue)
         : queue(queue)
         , kernel(program.get_hrtf_kernel())
@@ -135,6 +135,33 @@ struct JsonGetter<AttenuationModel> {
     std::map<AttenuationModel::Mode, std::string> keys;
 };
 
+/// Describes how diffuse energy is registered at the receiver.
+///
+/// DIFFUSE_RAIN casts a visibility ray from every reflection of every ray to
+/// the receiver, and registers the diffusely reflected energy if the receiver
+/// is visible. Every reflection contributes, so the result has low variance,
+/// but the visibility ray roughly doubles the intersection work.
+///
+/// SPHERE registers a ray only when it passes through a detection sphere of
+/// the given radius around the receiver, which costs a single ray-sphere test
+/// per reflection. The chance of a ray passing through the sphere falls with
+/// the square of the distance travelled, so late energy is estimated from few
+/// rays and the result is noisier unless many more rays are traced. A larger
+/// sphere reduces the noise, but smears arrival times by up to the time taken
+/// to cross the sphere (roughly 3ms for a 0.5m radius).
+struct ReceiverModel {
+    enum Mode { DIFFUSE_RAIN, SPHERE };
+    Mode mode;
+    float radius;
+};
+
+/// A simplified version of a scene, used for reflections of the given order
+/// and above.
+struct LevelOfDetail {
+    unsigned long first_order;
+    SceneData scene;
+};
+
 /// Sum impulses ocurring at the same (sampled) time and return a vector in
 /// which each subsequent item refers to the next sample of an impulse
 /// response.
@@ -250,6 +277,81 @@ public:
                   const cl_float3 & source,
                   const std::vector<cl_float3> & directions);
 
+    /// Trace rays one reflection at a time, sorting them by direction and
+    /// origin in between reflections.
+    /// Sorting keeps neighbouring work-items coherent in later reflections,
+    /// at the cost of a sort per reflection.
+    void setSortRays(bool b);
+    bool getSortRays() const;
+
+    /// Copy the scene geometry into local memory before tracing.
+    /// This is enabled automatically when the scene fits in the local memory
+    /// of the device, but may be disabled (for example, for benchmarking).
+    /// Has no effect when rays are sorted.
+    void setUseLocalMemory(bool b);
+    bool getUseLocalMemory() const;
+
+    /// Choose how diffuse energy is registered at the microphone.
+    void setReceiverModel(const ReceiverModel & model);
+    ReceiverModel getReceiverModel() const;
+
+    /// Look up receiver visibility for diffuse rain in a precomputed map,
+    /// rather than tracing a visibility ray from every reflection.
+    /// The map samples visibility at the centre of each cell of a
+    /// resolution * resolution grid over every triangle, so it costs
+    /// ntriangles * resolution^2 visibility rays to build, after which each
+    /// lookup is constant-time.
+    /// Visibility is assumed to be constant across a cell, so reflections
+    /// near the edge of a shadow may be registered incorrectly. The error
+    /// shrinks as the resolution increases.
+    /// A resolution of zero (the default) disables the map.
+    void setVisibilityMapResolution(cl_uint resolution);
+    cl_uint getVisibilityMapResolution() const;
+
+    /// Build the visibility map for a microphone position.
+    /// The map is cached, so this only does work when the microphone, the
+    /// resolution, or the scene has changed since the last call.
+    /// It is called automatically by raytrace().
+    void prepareVisibilityMap(const cl_float3 & micpos);
+
+    /// Whether an up-to-date visibility map is cached for a microphone
+    /// position.
+    bool hasVisibilityMap(const cl_float3 & micpos) const;
+
+    /// Trace late reflections against simplified versions of the scene.
+    /// Each level is used from its first_order until the first_order of the
+    /// next level. Levels must be given in order of increasing first_order,
+    /// and must use the same surfaces as the full scene.
+    /// The image-source stage always uses the full scene, so first_order is
+    /// raised to NUM_IMAGE_SOURCE - 1 if it is lower.
+    /// The visibility map only applies to reflections traced against the full
+    /// scene.
+    /// Pass an empty vector to trace every reflection against the full scene.
+    void setLevelsOfDetail(const std::vector<LevelOfDetail> & levels);
+
+    /// Replace a contiguous range of scene vertices, starting at index first,
+    /// without rebuilding the raytracer.
+    /// The model bounds are refitted and the visibility map is invalidated.
+    /// Simplified levels of detail can't be refitted, so they are discarded
+    /// and must be set again if required.
+    void updateVertices(cl_ulong first,
+                        const std::vector<cl_float3> & vertices);
+
+    /// Replace a contiguous range of surfaces, starting at index first,
+    /// without rebuilding the raytracer.
+    void updateSurfaces(cl_ulong first, const std::vector<Surface> & surfaces);
+
+    /// Find image sources up to the given reflection order by expanding the
+    /// full tree of image sources on the device, instead of recording the
+    /// surfaces hit by random rays.
+    /// Every valid path up to the order is found, and rays no longer do any
+    /// image-source work. However, the tree may grow as fast as
+    /// ntriangles^order, so this suits low orders or simple scenes best.
+    /// The order must not exceed NUM_IMAGE_SOURCE - 1.
+    /// An order of zero (the default) finds image sources with rays.
+    void setImageSourceOrder(unsigned long order);
+    unsigned long getImageSourceOrder() const;
+
     /// Get raw, unprocessed diffuse results.
     RaytracerResults getRawDiffuse();
 
@@ -260,11 +362,67 @@ public:
     RaytracerResults getAllRaw(bool removeDirect);
 
 private:
+    using raytrace_local_kernel_type =
+        decltype(std::declval<RayverbProgram>().get_raytrace_local_kernel());
+    using init_rays_kernel_type =
+        decltype(std::declval<RayverbProgram>().get_init_rays_kernel());
+    using raytrace_step_kernel_type =
+        decltype(std::declval<RayverbProgram>().get_raytrace_step_kernel());
+    using receiver_visibility_map_kernel_type = decltype(
+        std::declval<RayverbProgram>().get_receiver_visibility_map_kernel());
+    using image_source_count_kernel_type = decltype(
+        std::declval<RayverbProgram>().get_image_source_count_kernel());
+    using image_source_expand_kernel_type = decltype(
+        std::declval<RayverbProgram>().get_image_source_expand_kernel());
+    using image_source_validate_kernel_type = decltype(
+        std::declval<RayverbProgram>().get_image_source_validate_kernel());
+    using ray_keys_kernel_type =
+        decltype(std::declval<RayverbProgram>().get_ray_keys_kernel());
+    using sort_ray_keys_kernel_type =
+        decltype(std::declval<RayverbProgram>().get_sort_ray_keys_kernel());
+    using permute_rays_kernel_type =
+        decltype(std::declval<RayverbProgram>().get_permute_rays_kernel());
+
+    /// Trace the current group of rays one reflection at a time.
+    void raytraceSorted(const cl_float3 & micpos, const cl_float3 & source);
+
+    /// Sort the current ray states by direction and origin.
+    void reorderRays();
+
+    /// Find image sources with the image-source tree, adding them to the
+    /// tally.
+    void findImageSources(const cl_float3 & micpos, const cl_float3 & source);
+
+    /// The image-source buffers passed to the ray kernels, which are null
+    /// when the image-source tree is used instead.
+    cl::Buffer rayImageSource() const;
+    cl::Buffer rayImageSourceIndex() const;
+
+    /// The number of bytes of local memory needed to hold the scene geometry.
+    size_t localMemoryRequired() const;
+    bool sceneFitsLocalMemory() const;
+
+    /// The receiver radius passed to the kernels, where zero selects diffuse
+    /// rain.
+    cl_float receiverRadius() const;
+
     cl::CommandQueue & queue;
     kernel_type kernel;
+    raytrace_local_kernel_type raytrace_local_kernel;
+    init_rays_kernel_type init_rays_kernel;
+    raytrace_step_kernel_type raytrace_step_kernel;
+    receiver_visibility_map_kernel_type receiver_visibility_map_kernel;
+    image_source_count_kernel_type image_source_count_kernel;
+    image_source_expand_kernel_type image_source_expand_kernel;
+    image_source_validate_kernel_type image_source_validate_kernel;
+    ray_keys_kernel_type ray_keys_kernel;
+    sort_ray_keys_kernel_type sort_ray_keys_kernel;
+    permute_rays_kernel_type permute_rays_kernel;
 
     const unsigned long nreflections;
     const unsigned long ntriangles;
+    const unsigned long nvertices;
+    const unsigned long nsurfaces;
 
     cl::Buffer cl_directions;
     cl::Buffer cl_triangles;
@@ -273,17 +431,85 @@ private:
     cl::Buffer cl_impulses;
     cl::Buffer cl_image_source;
     cl::Buffer cl_image_source_index;
-
+    std::array<cl::Buffer, 2> cl_ray_states;
+    cl::Buffer cl_ray_keys;
+    cl::Buffer cl_ray_primitives;
+    cl::Buffer cl_receiver_visibility;
+    cl::Buffer cl_lod_triangles;
+    cl::Buffer cl_lod_vertices;
+    cl::Buffer cl_lod_ranges;
+
+    std::vector<cl_float3> scene_vertices;
     std::pair<cl_float3, cl_float3> bounds;
 
+    bool sort_rays{false};
+    bool use_local_memory;
+    ReceiverModel receiver_model{ReceiverModel::DIFFUSE_RAIN, 0};
+
+    unsigned long image_source_order{0};
+
+    cl_uint visibility_resolution{0};
+    bool visibility_map_valid{false};
+    cl_float3 visibility_map_micpos;
+
     cl_float3 storedMicpos;
 
     static const auto RAY_GROUP_SIZE = 4096u;
+    static const auto IMAGE_SOURCE_CAPACITY = 1u << 20;
 
     std::vector<Impulse> storedDiffuse;
     std::map<std::vector<unsigned long>, Impulse> imageSourceTally;
 };
 
+/// Traces several small scenes, or several mic/source pairs in the same
+/// scene, in a single kernel launch.
+/// Scenes with only a handful of triangles leave most of the device idle when
+/// traced one at a time, so the scenes are concatenated into shared buffers
+/// and every job is traced by the same launch.
+class BatchRaytrace {
+public:
+    /// A mic and source position in one of the batched scenes.
+    struct Job {
+        std::vector<SceneData>::size_type scene;
+        cl_float3 mic;
+        cl_float3 source;
+    };
+
+    BatchRaytrace(const RayverbProgram & program,
+                  cl::CommandQueue & queue,
+                  unsigned long nreflections,
+                  const std::vector<SceneData> & scenes);
+
+    /// Trace every job with the same set of directions.
+    void raytrace(const std::vector<Job> & jobs,
+                  const std::vector<cl_float3> & directions);
+
+    /// Get all raw, unprocessed results, in the same order as the jobs.
+    std::vector<RaytracerResults> getAllRaw(bool removeDirect);
+
+private:
+    using kernel_type =
+        decltype(std::declval<RayverbProgram>().get_raytrace_batch_kernel());
+
+    cl::CommandQueue & queue;
+    kernel_type kernel;
+
+    const unsigned long nreflections;
+
+    /// The first triangle, and the number of triangles, in each scene.
+    std::vector<std::pair<cl_ulong, cl_ulong>> scene_triangles;
+
+    cl::Buffer cl_triangles;
+    cl::Buffer cl_vertices;
+    cl::Buffer cl_surfaces;
+
+    static const auto RAY_GROUP_SIZE = 4096u;
+
+    std::vector<cl_float3> storedMicpos;
+    std::vector<std::vector<Impulse>> storedDiffuse;
+    std::vector<std::map<std::vector<unsigned long>, Impulse>> imageSourceTally;
+};
+
 /// Class for parallel HRTF attenuation of raytrace results.
 class Hrtf {
 public:
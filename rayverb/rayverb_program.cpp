@@ -1,4 +1,5 @@
 #include "rayverb_program.h"
+#include "sphere_receiver.h"
 #include "test_flag.h"
 
 RayverbProgram::RayverbProgram(const cl::Context & context,
@@ -6,105 +7,19 @@ RayverbProgram::RayverbProgram(const cl::Context & context,
         : Program(context, source, build_immediate) {
 }
 
-const std::string RayverbProgram::source(
-#ifdef TESTING
-    "#define TESTING\n"
-#endif
-    "#define NUM_IMAGE_SOURCE " +
-    std::to_string(NUM_IMAGE_SOURCE) +
-    "\n"
-    "#define SPEED_OF_SOUND " +
-    std::to_string(SPEED_OF_SOUND) +
-    "\n"
-    R"(
-
-#define EPSILON (0.0001f)
-#define NULL (0)
-
-constant float SECONDS_PER_METER = 1.0f / SPEED_OF_SOUND;
-typedef float8 VolumeType;
-
-typedef struct {
-    float3 position;
-    float3 direction;
-} Ray;
-
-typedef struct {
-    VolumeType specular;
-    VolumeType diffuse;
-} Surface;
-
-typedef struct {
-    unsigned long surface;
-    unsigned long v0;
-    unsigned long v1;
-    unsigned long v2;
-} Triangle;
-
-typedef struct {
-    unsigned long primitive;
-    float distance;
-    bool intersects;
-} Intersection;
-
-typedef struct {
-    VolumeType volume;
-    float3 position;
-    float time;
-} Impulse;
-
-typedef struct {
-    VolumeType volume;
-    float time;
-} AttenuatedImpulse;
-
-typedef struct {
-    float3 direction;
-    float coefficient;
-} Speaker;
-
-typedef struct {
-    float3 v0;
-    float3 v1;
-    float3 v2;
-} TriangleVerts;
-
-float triangle_vert_intersection (TriangleVerts * v, Ray * ray);
-float triangle_vert_intersection (TriangleVerts * v, Ray * ray)
-{
-    float3 e0 = v->v1 - v->v0;
-    float3 e1 = v->v2 - v->v0;
-
-    float3 pvec = cross (ray->direction, e1);
-    float det = dot (e0, pvec);
-
-    if (-EPSILON < det && det < EPSILON)
-        return 0.0f;
-
-    float invdet = 1.0f / det;
-    float3 tvec = ray->position - v->v0;
-    float ucomp = invdet * dot (tvec, pvec);
-
-    if (ucomp < 0.0f || 1.0f < ucomp)
-        return 0.0f;
-
-    float3 qvec = cross (tvec, e0);
-    float vcomp = invdet * dot (ray->direction, qvec);
-
-    if (vcomp < 0.0f || 1.0f < vcomp + ucomp)
-        return 0.0f;
-
-    return invdet * dot (e1, qvec);
-}
-
-float triangle_intersection
-(   global Triangle * triangle
-,   global float3 * vertices
+//  Functions which read the scene geometry.
+//  OpenCL C has no generic address space, so these are compiled twice: once
+//  for geometry in global memory, and once (with a _local suffix) for
+//  geometry that has been copied into local memory.
+static const std::string scene_functions(R"(
+float SCENE_FUNCTION (triangle_intersection)
+(   SCENE_SPACE Triangle * triangle
+,   SCENE_SPACE float3 * vertices
 ,   Ray * ray
 );
-float triangle_intersection
-(   global Triangle * triangle
-,   global float3 * vertices
+float SCENE_FUNCTION (triangle_intersection)
+(   SCENE_SPACE Triangle * triangle
+,   SCENE_SPACE float3 * vertices
 ,   Ray * ray
 )
 {
@@ -116,17 +31,8 @@ float triangle_intersection
     return triangle_vert_intersection (&v, ray);
 }
 
-float3 triangle_verts_normal (TriangleVerts * t);
-float3 triangle_verts_normal (TriangleVerts * t)
-{
-    float3 e0 = t->v1 - t->v0;
-    float3 e1 = t->v2 - t->v0;
-
-    return normalize (cross (e0, e1));
-}
-
-float3 triangle_normal (global Triangle * triangle, global float3 * vertices);
-float3 triangle_normal (global Triangle * triangle, global float3 * vertices)
+float3 SCENE_FUNCTION (triangle_normal) (SCENE_SPACE Triangle * triangle, SCENE_SPACE float3 * vertices);
+float3 SCENE_FUNCTION (triangle_normal) (SCENE_SPACE Triangle * triangle, SCENE_SPACE float3 * vertices)
 {
     TriangleVerts t =
     {   vertices [triangle->v0]
@@ -136,57 +42,45 @@ float3 triangle_normal (global Triangle * triangle, global float3 * vertices)
     return triangle_verts_normal (&t);
 }
 
-float3 reflect (float3 normal, float3 direction);
-float3 reflect (float3 normal, float3 direction)
-{
-    return direction - (normal * 2 * dot (direction, normal));
-}
-
-Ray ray_reflect (Ray * ray, float3 normal, float3 intersection);
-Ray ray_reflect (Ray * ray, float3 normal, float3 intersection)
-{
-    return (Ray) {intersection, reflect (normal, ray->direction)};
-}
-
-Ray triangle_reflectAt
-(   global Triangle * triangle
-,   global float3 * vertices
+Ray SCENE_FUNCTION (triangle_reflectAt)
+(   SCENE_SPACE Triangle * triangle
+,   SCENE_SPACE float3 * vertices
 ,   Ray * ray
 ,   float3 intersection
 );
-Ray triangle_reflectAt
-(   global Triangle * triangle
-,   global float3 * vertices
+Ray SCENE_FUNCTION (triangle_reflectAt)
+(   SCENE_SPACE Triangle * triangle
+,   SCENE_SPACE float3 * vertices
 ,   Ray * ray
 ,   float3 intersection
 )
 {
     return ray_reflect
     (   ray
-    ,   triangle_normal (triangle, vertices)
+    ,   SCENE_FUNCTION (triangle_normal) (triangle, vertices)
     ,   intersection
     );
 }
 
-Intersection ray_triangle_intersection
+Intersection SCENE_FUNCTION (ray_triangle_intersection)
 (   Ray * ray
-,   global Triangle * triangles
+,   SCENE_SPACE Triangle * triangles
 ,   unsigned long numtriangles
-,   global float3 * vertices
+,   SCENE_SPACE float3 * vertices
 );
-Intersection ray_triangle_intersection
+Intersection SCENE_FUNCTION (ray_triangle_intersection)
 (   Ray * ray
-,   global Triangle * triangles
+,   SCENE_SPACE Triangle * triangles
 ,   unsigned long numtriangles
-,   global float3 * vertices
+,   SCENE_SPACE float3 * vertices
 )
 {
     Intersection ret = {0, 0, false};
 
     for (unsigned long i = 0; i != numtriangles; ++i)
     {
-        global Triangle * thisTriangle = triangles + i;
-        float distance = triangle_intersection (thisTriangle, vertices, ray);
+        SCENE_SPACE Triangle * thisTriangle = triangles + i;
+        float distance = SCENE_FUNCTION (triangle_intersection) (thisTriangle, vertices, ray);
         if
         (   distance > EPSILON
         &&  (   !ret.intersects
@@ -201,92 +95,19 @@ Intersection ray_triangle_intersection
     return ret;
 }
 
-VolumeType air_attenuation_for_distance (float distance, VolumeType AIR_COEFFICIENT);
-VolumeType air_attenuation_for_distance (float distance, VolumeType AIR_COEFFICIENT)
-{
-    return pow (M_E, distance * AIR_COEFFICIENT);
-}
-
-float power_attenuation_for_distance (float distance);
-float power_attenuation_for_distance (float distance)
-{
-    //return 1 / (distance * distance);
-    return 1;
-}
-
-VolumeType attenuation_for_distance (float distance, VolumeType AIR_COEFFICIENT);
-VolumeType attenuation_for_distance (float distance, VolumeType AIR_COEFFICIENT)
-{
-    return
-    (   air_attenuation_for_distance (distance, AIR_COEFFICIENT)
-    *   power_attenuation_for_distance (distance)
-    );
-}
-
-void mirror_point (float3 * p, TriangleVerts * t);
-void mirror_point (float3 * p, TriangleVerts * t)
-{
-    float3 n = triangle_verts_normal (t);
-    *p += -n * dot (n, *p - t->v0) * 2;
-}
-
-void mirror_verts (TriangleVerts * in, TriangleVerts * t);
-void mirror_verts (TriangleVerts * in, TriangleVerts * t)
-{
-    mirror_point (&in->v0, t);
-    mirror_point (&in->v1, t);
-    mirror_point (&in->v2, t);
-}
-
-void add_image
-(   float3 mic_position
-,   float3 mic_reflection
-,   float3 source
-,   global Impulse * image_source
-,   global unsigned long * image_source_index
-,   size_t thread_index
-,   size_t thread_offset_index
-,   VolumeType volume
-,   unsigned long object_index
-,   VolumeType AIR_COEFFICIENT
-);
-void add_image
-(   float3 mic_position
-,   float3 mic_reflection
-,   float3 source
-,   global Impulse * image_source
-,   global unsigned long * image_source_index
-,   size_t thread_index
-,   size_t thread_offset_index
-,   VolumeType volume
-,   unsigned long object_index
-,   VolumeType AIR_COEFFICIENT
-)
-{
-    const float3 INIT_DIFF = source - mic_reflection;
-    const float INIT_DIST = length (INIT_DIFF);
-    const size_t OFFSET = thread_index * NUM_IMAGE_SOURCE + thread_offset_index;
-    image_source [OFFSET] = (Impulse)
-    {   volume * attenuation_for_distance (INIT_DIST, AIR_COEFFICIENT)
-    ,   mic_position + INIT_DIFF
-    ,   SECONDS_PER_METER * INIT_DIST
-    };
-    image_source_index [OFFSET] = object_index;
-}
-
-bool point_intersection
+bool SCENE_FUNCTION (point_intersection)
 (   float3 begin
 ,   float3 point
-,   global Triangle * triangles
+,   SCENE_SPACE Triangle * triangles
 ,   unsigned long numtriangles
-,   global float3 * vertices
+,   SCENE_SPACE float3 * vertices
 );
-bool point_intersection
+bool SCENE_FUNCTION (point_intersection)
 (   float3 begin
 ,   float3 point
-,   global Triangle * triangles
+,   SCENE_SPACE Triangle * triangles
 ,   unsigned long numtriangles
-,   global float3 * vertices
+,   SCENE_SPACE float3 * vertices
 )
 {
     const float3 begin_to_point = point - begin;
@@ -295,7 +116,7 @@ bool point_intersection
 
     Ray to_point = {begin, direction};
 
-    Intersection inter = ray_triangle_intersection
+    Intersection inter = SCENE_FUNCTION (ray_triangle_intersection)
     (   &to_point
     ,   triangles
     ,   numtriangles
@@ -305,47 +126,38 @@ bool point_intersection
     return (!inter.intersects) || inter.distance > mag;
 }
 
-float3 getDirection (float3 from, float3 to);
-float3 getDirection (float3 from, float3 to)
-{
-    return normalize (to - from);
-}
-
-kernel void raytrace
-(   global float3 * directions
-,   float3 position
-,   global Triangle * triangles
+void SCENE_FUNCTION (add_direct_image)
+(   float3 position
+,   float3 source
+,   SCENE_SPACE Triangle * triangles
 ,   unsigned long numtriangles
-,   global float3 * vertices
+,   SCENE_SPACE float3 * vertices
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   size_t thread_index
+,   VolumeType AIR_COEFFICIENT
+);
+void SCENE_FUNCTION (add_direct_image)
+(   float3 position
 ,   float3 source
-,   global Surface * surfaces
-,   global Impulse * impulses
+,   SCENE_SPACE Triangle * triangles
+,   unsigned long numtriangles
+,   SCENE_SPACE float3 * vertices
 ,   global Impulse * image_source
 ,   global unsigned long * image_source_index
-,   unsigned long outputOffset
+,   size_t thread_index
 ,   VolumeType AIR_COEFFICIENT
 )
 {
-    size_t i = get_global_id (0);
-
-    //  This is really a recursive algorithm, but I've implemented it
-    //  iteratively.
-    //  These variables will be updated as the ray is traced.
-
-    //  These variables relate to the ray itself, and are used for the diffuse
-    //  trace.
-    Ray ray = {source, directions [i]};
-    float distance = 0;
-    VolumeType volume = 1;
-
-    //  These variables are for image_source approximation.
-    TriangleVerts prev_primitives [NUM_IMAGE_SOURCE - 1];
-    float3 mic_reflection = position;
+    if (! image_source)
+    {
+        return;
+    }
 
     if
-    (   point_intersection
+    (   SCENE_FUNCTION (point_intersection)
         (   source
-        ,   mic_reflection
+        ,   position
         ,   triangles
         ,   numtriangles
         ,   vertices
@@ -354,138 +166,217 @@ kernel void raytrace
     {
         add_image
         (   position
-        ,   mic_reflection
+        ,   position
         ,   source
         ,   image_source
         ,   image_source_index
-        ,   i
+        ,   thread_index
         ,   0
-        ,   volume
+        ,   (VolumeType) (1)
         ,   0
         ,   AIR_COEFFICIENT
         );
     }
+}
 
-    for (unsigned long index = 0; index != outputOffset; ++index)
-    {
-        //  Check for an intersection between the current ray and all the
-        //  scene geometry.
-        Intersection closest = ray_triangle_intersection
-        (   &ray
-        ,   triangles
-        ,   numtriangles
-        ,   vertices
-        );
-
-        //  If there's no intersection, the ray's somehow shot into empty space
-        //  and we should stop tracing.
-        if (! closest.intersects)
-        {
-            break;
-        }
-
-        global Triangle * triangle = triangles + closest.primitive;
-
-        if (index < NUM_IMAGE_SOURCE - 1)
-        {
-            TriangleVerts current =
-            {   vertices [triangle->v0]
-            ,   vertices [triangle->v1]
-            ,   vertices [triangle->v2]
-            };
-
-            for (unsigned int k = 0; k != index; ++k)
-            {
-                mirror_verts (&current, prev_primitives + k);
-            }
-
-            prev_primitives [index] = current;
+//  Traces a single reflection of a ray, updating its state.
+//  Returns false if the ray has left the scene and should not be traced any
+//  further.
+bool SCENE_FUNCTION (trace_reflection)
+(   RayState * state
+,   TriangleVerts * prev_primitives
+,   unsigned long index
+,   float3 position
+,   SCENE_SPACE Triangle * triangles
+,   unsigned long numtriangles
+,   SCENE_SPACE float3 * vertices
+,   float3 source
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   unsigned long outputOffset
+,   VolumeType AIR_COEFFICIENT
+,   float receiver_radius
+,   global uchar * receiver_visibility
+,   uint visibility_resolution
+);
+bool SCENE_FUNCTION (trace_reflection)
+(   RayState * state
+,   TriangleVerts * prev_primitives
+,   unsigned long index
+,   float3 position
+,   SCENE_SPACE Triangle * triangles
+,   unsigned long numtriangles
+,   SCENE_SPACE float3 * vertices
+,   float3 source
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   unsigned long outputOffset
+,   VolumeType AIR_COEFFICIENT
+,   float receiver_radius
+,   global uchar * receiver_visibility
+,   uint visibility_resolution
+)
+{
+    const size_t i = state->ray_index;
+
+    //  Check for an intersection between the current ray and all the
+    //  scene geometry.
+    Intersection closest = SCENE_FUNCTION (ray_triangle_intersection)
+    (   &state->ray
+    ,   triangles
+    ,   numtriangles
+    ,   vertices
+    );
 
-            mirror_point (&mic_reflection, &current);
+    //  If there's no intersection, the ray's somehow shot into empty space
+    //  and we should stop tracing.
+    if (! closest.intersects)
+    {
+        return false;
+    }
 
-            const float3 DIR = getDirection (source, mic_reflection);
+    SCENE_SPACE Triangle * triangle = triangles + closest.primitive;
 
-            Ray toMic = {source, DIR};
-            bool intersects = true;
-            float3 prevIntersection = source;
-            for (unsigned long k = 0; k != index + 1 && intersects; ++k)
-            {
-                const float TO_INTERSECTION = triangle_vert_intersection (prev_primitives + k, &toMic);
-
-                if (TO_INTERSECTION <= EPSILON)
-                {
-                    intersects = false;
-                    break;
-                }
-
-                float3 intersectionPoint = source + DIR * TO_INTERSECTION;
-                for (long l = k - 1; l != -1; --l)
-                {
-                    mirror_point (&intersectionPoint, prev_primitives + l);
-                }
-
-                Ray intermediate = {prevIntersection, getDirection (prevIntersection, intersectionPoint)};
-                Intersection inter = ray_triangle_intersection
-                (   &intermediate
-                ,   triangles
-                ,   numtriangles
-                ,   vertices
-                );
-
-                float3 newIntersectionPoint = intermediate.position + intermediate.direction * inter.distance;
-                intersects = inter.intersects && all (newIntersectionPoint - EPSILON < intersectionPoint) && all (intersectionPoint < newIntersectionPoint + EPSILON);
-
-                prevIntersection = intersectionPoint;
-            }
+    //  Image sources are found by a separate stage if image_source is NULL.
+    if (image_source && index < NUM_IMAGE_SOURCE - 1)
+    {
+        TriangleVerts current =
+        {   vertices [triangle->v0]
+        ,   vertices [triangle->v1]
+        ,   vertices [triangle->v2]
+        };
 
-            if (intersects)
+        for (unsigned int k = 0; k != index; ++k)
+        {
+            mirror_verts (&current, prev_primitives + k);
+        }
+
+        prev_primitives [index] = current;
+
+        mirror_point (&state->mic_reflection, &current);
+
+        const float3 DIR = getDirection (source, state->mic_reflection);
+
+        Ray toMic = {source, DIR};
+        bool intersects = true;
+        float3 prevIntersection = source;
+        for (unsigned long k = 0; k != index + 1 && intersects; ++k)
+        {
+            const float TO_INTERSECTION = triangle_vert_intersection (prev_primitives + k, &toMic);
+
+            if (TO_INTERSECTION <= EPSILON)
             {
-                intersects = point_intersection
-                (   prevIntersection
-                ,   position
-                ,   triangles
-                ,   numtriangles
-                ,   vertices
-                );
+                intersects = false;
+                break;
             }
 
-            if (intersects)
+            float3 intersectionPoint = source + DIR * TO_INTERSECTION;
+            for (long l = k - 1; l != -1; --l)
             {
-                add_image
-                (   position
-                ,   mic_reflection
-                ,   source
-                ,   image_source
-                ,   image_source_index
-                ,   i
-                ,   index + 1
-                ,   volume
-                ,   closest.primitive + 1
-                ,   AIR_COEFFICIENT
-                );
+                mirror_point (&intersectionPoint, prev_primitives + l);
             }
+
+            Ray intermediate = {prevIntersection, getDirection (prevIntersection, intersectionPoint)};
+            Intersection inter = SCENE_FUNCTION (ray_triangle_intersection)
+            (   &intermediate
+            ,   triangles
+            ,   numtriangles
+            ,   vertices
+            );
+
+            float3 newIntersectionPoint = intermediate.position + intermediate.direction * inter.distance;
+            intersects = inter.intersects && all (newIntersectionPoint - EPSILON < intersectionPoint) && all (intersectionPoint < newIntersectionPoint + EPSILON);
+
+            prevIntersection = intersectionPoint;
         }
 
-        float3 intersection = ray.position + ray.direction * closest.distance;
-        float newDist = distance + closest.distance;
-        VolumeType newVol = -volume * surfaces [triangle->surface].specular;
+        if (intersects)
+        {
+            intersects = SCENE_FUNCTION (point_intersection)
+            (   prevIntersection
+            ,   position
+            ,   triangles
+            ,   numtriangles
+            ,   vertices
+            );
+        }
 
-        const bool IS_INTERSECTION = point_intersection
-        (   intersection
-        ,   position
-        ,   triangles
-        ,   numtriangles
-        ,   vertices
-        );
+        if (intersects)
+        {
+            add_image
+            (   position
+            ,   state->mic_reflection
+            ,   source
+            ,   image_source
+            ,   image_source_index
+            ,   i
+            ,   index + 1
+            ,   state->volume
+            ,   closest.primitive + 1
+            ,   AIR_COEFFICIENT
+            );
+        }
+    }
+
+    float3 intersection = state->ray.position + state->ray.direction * closest.distance;
+    float newDist = state->distance + closest.distance;
+    VolumeType newVol = -state->volume * surfaces [triangle->surface].specular;
+
+    if (0 < receiver_radius)
+    {
+        //  The direct path is found by the image-source method, so only
+        //  reflected rays are registered.
+        impulses [i * outputOffset + index] =
+            0 < index
+        ?   sphere_receiver_impulse
+            (   &state->ray
+            ,   closest.distance
+            ,   state->distance
+            ,   state->volume
+            ,   position
+            ,   receiver_radius
+            ,   AIR_COEFFICIENT
+            )
+        :   (Impulse) {(VolumeType) (0), intersection, 0};
+    }
+    else
+    {
+        bool IS_INTERSECTION;
+        if (visibility_resolution)
+        {
+            TriangleVerts current =
+            {   vertices [triangle->v0]
+            ,   vertices [triangle->v1]
+            ,   vertices [triangle->v2]
+            };
+            IS_INTERSECTION = receiver_visibility
+            [   closest.primitive * visibility_resolution * visibility_resolution
+            +   visibility_cell (&current, intersection, visibility_resolution)
+            ];
+        }
+        else
+        {
+            IS_INTERSECTION = SCENE_FUNCTION (point_intersection)
+            (   intersection
+            ,   position
+            ,   triangles
+            ,   numtriangles
+            ,   vertices
+            );
+        }
 
         const float DIST = IS_INTERSECTION ? newDist + length (position - intersection) : 0;
-        //const float DIFF = fabs (dot (triangle_normal (triangle, vertices), normalize (position - intersection)));
+        //const float DIFF = fabs (dot (SCENE_FUNCTION (triangle_normal) (triangle, vertices), normalize (position - intersection)));
 
         //  The reflected luminous intensity in any direction from a perfectly
         //  diffusing surface varies as the cosine of the angle between the
         //  direction of incident light and the normal vector of the surface.
         //  http://www.cs.rit.edu/~jmg/courses/procshade/20073/slides/3-1-brdf.pdf
-        const float DIFF = fabs (dot (triangle_normal (triangle, vertices), ray.direction));
+        const float DIFF = fabs (dot (SCENE_FUNCTION (triangle_normal) (triangle, vertices), state->ray.direction));
         impulses [i * outputOffset + index] = (Impulse)
         {   (   IS_INTERSECTION
             ?   (   newVol
@@ -498,19 +389,1148 @@ kernel void raytrace
         ,   intersection
         ,   SECONDS_PER_METER * DIST
         };
+    }
 
-        Ray newRay = triangle_reflectAt
-        (   triangle
-        ,   vertices
-        ,   &ray
-        ,   intersection
+    Ray newRay = SCENE_FUNCTION (triangle_reflectAt)
+    (   triangle
+    ,   vertices
+    ,   &state->ray
+    ,   intersection
+    );
+
+    state->ray = newRay;
+    state->distance = newDist;
+    state->volume = newVol;
+
+    return true;
+}
+
+//  Traces a reflection against a simplified version of the scene, if one has
+//  been supplied for this reflection, or against the full scene otherwise.
+//  The simplified scenes always live in global memory.
+bool SCENE_FUNCTION (trace_reflection_lod)
+(   RayState * state
+,   TriangleVerts * prev_primitives
+,   unsigned long index
+,   float3 position
+,   SCENE_SPACE Triangle * triangles
+,   unsigned long numtriangles
+,   SCENE_SPACE float3 * vertices
+,   global Triangle * lod_triangles
+,   global float3 * lod_vertices
+,   global LodRange * lod_ranges
+,   float3 source
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   unsigned long outputOffset
+,   VolumeType AIR_COEFFICIENT
+,   float receiver_radius
+,   global uchar * receiver_visibility
+,   uint visibility_resolution
+);
+bool SCENE_FUNCTION (trace_reflection_lod)
+(   RayState * state
+,   TriangleVerts * prev_primitives
+,   unsigned long index
+,   float3 position
+,   SCENE_SPACE Triangle * triangles
+,   unsigned long numtriangles
+,   SCENE_SPACE float3 * vertices
+,   global Triangle * lod_triangles
+,   global float3 * lod_vertices
+,   global LodRange * lod_ranges
+,   float3 source
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   unsigned long outputOffset
+,   VolumeType AIR_COEFFICIENT
+,   float receiver_radius
+,   global uchar * receiver_visibility
+,   uint visibility_resolution
+)
+{
+    if (lod_ranges && lod_ranges [index].numtriangles)
+    {
+        return trace_reflection
+        (   state
+        ,   prev_primitives
+        ,   index
+        ,   position
+        ,   lod_triangles + lod_ranges [index].triangle_offset
+        ,   lod_ranges [index].numtriangles
+        ,   lod_vertices
+        ,   source
+        ,   surfaces
+        ,   impulses
+        ,   image_source
+        ,   image_source_index
+        ,   outputOffset
+        ,   AIR_COEFFICIENT
+        ,   receiver_radius
+        ,   NULL
+        ,   0
         );
+    }
+
+    return SCENE_FUNCTION (trace_reflection)
+    (   state
+    ,   prev_primitives
+    ,   index
+    ,   position
+    ,   triangles
+    ,   numtriangles
+    ,   vertices
+    ,   source
+    ,   surfaces
+    ,   impulses
+    ,   image_source
+    ,   image_source_index
+    ,   outputOffset
+    ,   AIR_COEFFICIENT
+    ,   receiver_radius
+    ,   receiver_visibility
+    ,   visibility_resolution
+    );
+}
+
+void SCENE_FUNCTION (trace_ray)
+(   size_t i
+,   float3 direction
+,   float3 position
+,   SCENE_SPACE Triangle * triangles
+,   unsigned long numtriangles
+,   SCENE_SPACE float3 * vertices
+,   global Triangle * lod_triangles
+,   global float3 * lod_vertices
+,   global LodRange * lod_ranges
+,   float3 source
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   unsigned long outputOffset
+,   VolumeType AIR_COEFFICIENT
+,   float receiver_radius
+,   global uchar * receiver_visibility
+,   uint visibility_resolution
+);
+void SCENE_FUNCTION (trace_ray)
+(   size_t i
+,   float3 direction
+,   float3 position
+,   SCENE_SPACE Triangle * triangles
+,   unsigned long numtriangles
+,   SCENE_SPACE float3 * vertices
+,   global Triangle * lod_triangles
+,   global float3 * lod_vertices
+,   global LodRange * lod_ranges
+,   float3 source
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   unsigned long outputOffset
+,   VolumeType AIR_COEFFICIENT
+,   float receiver_radius
+,   global uchar * receiver_visibility
+,   uint visibility_resolution
+)
+{
+    //  This is really a recursive algorithm, but I've implemented it
+    //  iteratively.
+    //  The ray state will be updated as the ray is traced.
+    RayState state = new_ray_state (source, direction, position, i);
+
+    //  These variables are for image_source approximation.
+    TriangleVerts prev_primitives [NUM_IMAGE_SOURCE - 1];
+
+    SCENE_FUNCTION (add_direct_image)
+    (   position
+    ,   source
+    ,   triangles
+    ,   numtriangles
+    ,   vertices
+    ,   image_source
+    ,   image_source_index
+    ,   i
+    ,   AIR_COEFFICIENT
+    );
 
-        ray = newRay;
-        distance = newDist;
-        volume = newVol;
+    for (unsigned long index = 0; index != outputOffset; ++index)
+    {
+        if
+        (   ! SCENE_FUNCTION (trace_reflection_lod)
+            (   &state
+            ,   prev_primitives
+            ,   index
+            ,   position
+            ,   triangles
+            ,   numtriangles
+            ,   vertices
+            ,   lod_triangles
+            ,   lod_vertices
+            ,   lod_ranges
+            ,   source
+            ,   surfaces
+            ,   impulses
+            ,   image_source
+            ,   image_source_index
+            ,   outputOffset
+            ,   AIR_COEFFICIENT
+            ,   receiver_radius
+            ,   receiver_visibility
+            ,   visibility_resolution
+            )
+        )
+        {
+            break;
+        }
     }
 }
+)");
+
+const std::string RayverbProgram::source(
+#ifdef TESTING
+    "#define TESTING\n"
+#endif
+    "#define NUM_IMAGE_SOURCE " +
+    std::to_string(NUM_IMAGE_SOURCE) +
+    "\n"
+    "#define SPEED_OF_SOUND " +
+    std::to_string(SPEED_OF_SOUND) +
+    "\n" +
+    sphere_receiver_source +
+    R"(
+
+#define EPSILON (0.0001f)
+#define NULL (0)
+
+constant float SECONDS_PER_METER = 1.0f / SPEED_OF_SOUND;
+typedef float8 VolumeType;
+
+typedef struct {
+    float3 position;
+    float3 direction;
+} Ray;
+
+typedef struct {
+    VolumeType specular;
+    VolumeType diffuse;
+} Surface;
+
+typedef struct {
+    unsigned long surface;
+    unsigned long v0;
+    unsigned long v1;
+    unsigned long v2;
+} Triangle;
+
+typedef struct {
+    unsigned long primitive;
+    float distance;
+    bool intersects;
+} Intersection;
+
+typedef struct {
+    VolumeType volume;
+    float3 position;
+    float time;
+} Impulse;
+
+typedef struct {
+    VolumeType volume;
+    float time;
+} AttenuatedImpulse;
+
+typedef struct {
+    float3 direction;
+    float coefficient;
+} Speaker;
+
+typedef struct {
+    float3 v0;
+    float3 v1;
+    float3 v2;
+} TriangleVerts;
+
+typedef struct {
+    unsigned long triangle_offset;
+    unsigned long numtriangles;
+} LodRange;
+
+float triangle_vert_intersection (TriangleVerts * v, Ray * ray);
+float triangle_vert_intersection (TriangleVerts * v, Ray * ray)
+{
+    float3 e0 = v->v1 - v->v0;
+    float3 e1 = v->v2 - v->v0;
+
+    float3 pvec = cross (ray->direction, e1);
+    float det = dot (e0, pvec);
+
+    if (-EPSILON < det && det < EPSILON)
+        return 0.0f;
+
+    float invdet = 1.0f / det;
+    float3 tvec = ray->position - v->v0;
+    float ucomp = invdet * dot (tvec, pvec);
+
+    if (ucomp < 0.0f || 1.0f < ucomp)
+        return 0.0f;
+
+    float3 qvec = cross (tvec, e0);
+    float vcomp = invdet * dot (ray->direction, qvec);
+
+    if (vcomp < 0.0f || 1.0f < vcomp + ucomp)
+        return 0.0f;
+
+    return invdet * dot (e1, qvec);
+}
+
+float3 triangle_verts_normal (TriangleVerts * t);
+float3 triangle_verts_normal (TriangleVerts * t)
+{
+    float3 e0 = t->v1 - t->v0;
+    float3 e1 = t->v2 - t->v0;
+
+    return normalize (cross (e0, e1));
+}
+
+//  Each triangle is covered by a resolution * resolution grid of cells in
+//  barycentric space, of which only the cells on or below the diagonal lie
+//  on the triangle.
+//  Returns the index of the cell containing a point on the triangle.
+uint visibility_cell (TriangleVerts * t, float3 p, uint resolution);
+uint visibility_cell (TriangleVerts * t, float3 p, uint resolution)
+{
+    const float3 e0 = t->v1 - t->v0;
+    const float3 e1 = t->v2 - t->v0;
+    const float3 e2 = p - t->v0;
+
+    const float d00 = dot (e0, e0);
+    const float d01 = dot (e0, e1);
+    const float d11 = dot (e1, e1);
+    const float d20 = dot (e2, e0);
+    const float d21 = dot (e2, e1);
+    const float denom = d00 * d11 - d01 * d01;
+
+    //  A degenerate triangle has no barycentric coordinates, so all its
+    //  points share the first cell.
+    //  Written so that a NaN denominator also takes this branch.
+    if (! (EPSILON * d00 * d11 < denom))
+    {
+        return 0;
+    }
+
+    //  Clamped before conversion, as converting an out of range float to
+    //  int is undefined.
+    const float u = clamp ((d11 * d20 - d01 * d21) / denom, 0.0f, 1.0f);
+    const float v = clamp ((d00 * d21 - d01 * d20) / denom, 0.0f, 1.0f);
+
+    const int a = clamp ((int) (u * resolution), 0, (int) (resolution - 1));
+    const int b = clamp ((int) (v * resolution), 0, (int) (resolution - 1) - a);
+    return a * resolution + b;
+}
+
+//  Returns a representative point for a cell of the visibility grid.
+//  Cells on the diagonal are only half-covered by the triangle, so the
+//  centroid of the covered half is used.
+float3 visibility_cell_point (TriangleVerts * t, uint a, uint b, uint resolution);
+float3 visibility_cell_point (TriangleVerts * t, uint a, uint b, uint resolution)
+{
+    const float offset = a + b + 1 == resolution ? 1.0f / 3 : 0.5f;
+    const float u = (a + offset) / resolution;
+    const float v = (b + offset) / resolution;
+    return t->v0 + (t->v1 - t->v0) * u + (t->v2 - t->v0) * v;
+}
+
+float3 reflect (float3 normal, float3 direction);
+float3 reflect (float3 normal, float3 direction)
+{
+    return direction - (normal * 2 * dot (direction, normal));
+}
+
+Ray ray_reflect (Ray * ray, float3 normal, float3 intersection);
+Ray ray_reflect (Ray * ray, float3 normal, float3 intersection)
+{
+    return (Ray) {intersection, reflect (normal, ray->direction)};
+}
+
+VolumeType air_attenuation_for_distance (float distance, VolumeType AIR_COEFFICIENT);
+VolumeType air_attenuation_for_distance (float distance, VolumeType AIR_COEFFICIENT)
+{
+    return pow (M_E, distance * AIR_COEFFICIENT);
+}
+
+float power_attenuation_for_distance (float distance);
+float power_attenuation_for_distance (float distance)
+{
+    //return 1 / (distance * distance);
+    return 1;
+}
+
+VolumeType attenuation_for_distance (float distance, VolumeType AIR_COEFFICIENT);
+VolumeType attenuation_for_distance (float distance, VolumeType AIR_COEFFICIENT)
+{
+    return
+    (   air_attenuation_for_distance (distance, AIR_COEFFICIENT)
+    *   power_attenuation_for_distance (distance)
+    );
+}
+
+void mirror_point (float3 * p, TriangleVerts * t);
+void mirror_point (float3 * p, TriangleVerts * t)
+{
+    float3 n = triangle_verts_normal (t);
+    *p += -n * dot (n, *p - t->v0) * 2;
+}
+
+void mirror_verts (TriangleVerts * in, TriangleVerts * t);
+void mirror_verts (TriangleVerts * in, TriangleVerts * t)
+{
+    mirror_point (&in->v0, t);
+    mirror_point (&in->v1, t);
+    mirror_point (&in->v2, t);
+}
+
+void add_image
+(   float3 mic_position
+,   float3 mic_reflection
+,   float3 source
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   size_t thread_index
+,   size_t thread_offset_index
+,   VolumeType volume
+,   unsigned long object_index
+,   VolumeType AIR_COEFFICIENT
+);
+void add_image
+(   float3 mic_position
+,   float3 mic_reflection
+,   float3 source
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   size_t thread_index
+,   size_t thread_offset_index
+,   VolumeType volume
+,   unsigned long object_index
+,   VolumeType AIR_COEFFICIENT
+)
+{
+    const float3 INIT_DIFF = source - mic_reflection;
+    const float INIT_DIST = length (INIT_DIFF);
+    const size_t OFFSET = thread_index * NUM_IMAGE_SOURCE + thread_offset_index;
+    image_source [OFFSET] = (Impulse)
+    {   volume * attenuation_for_distance (INIT_DIST, AIR_COEFFICIENT)
+    ,   mic_position + INIT_DIFF
+    ,   SECONDS_PER_METER * INIT_DIST
+    };
+    image_source_index [OFFSET] = object_index;
+}
+
+//  Registers a ray segment which passes through a detection sphere around the
+//  receiver.
+//  The contribution is weighted by the length of the chord through the sphere
+//  relative to the sphere's volume, so the level doesn't depend on the radius.
+Impulse sphere_receiver_impulse
+(   Ray * ray
+,   float segment_length
+,   float distance
+,   VolumeType volume
+,   float3 position
+,   float receiver_radius
+,   VolumeType AIR_COEFFICIENT
+);
+Impulse sphere_receiver_impulse
+(   Ray * ray
+,   float segment_length
+,   float distance
+,   VolumeType volume
+,   float3 position
+,   float receiver_radius
+,   VolumeType AIR_COEFFICIENT
+)
+{
+    const float3 to_centre = position - ray->position;
+    const float closest = dot (to_centre, ray->direction);
+    const float miss_squared = dot (to_centre, to_centre) - closest * closest;
+    const float chord = sphere_receiver_chord
+    (   closest
+    ,   miss_squared
+    ,   segment_length
+    ,   receiver_radius
+    );
+
+    if (chord <= 0)
+    {
+        return (Impulse) {(VolumeType) (0), ray->position, 0};
+    }
+
+    const float DIST = distance + clamp (closest, 0.0f, segment_length);
+    return (Impulse)
+    {   (   volume
+        *   attenuation_for_distance (DIST, AIR_COEFFICIENT)
+        *   sphere_receiver_weight (chord, receiver_radius)
+        )
+    ,   ray->position
+    ,   SECONDS_PER_METER * DIST
+    };
+}
+
+float3 getDirection (float3 from, float3 to);
+float3 getDirection (float3 from, float3 to)
+{
+    return normalize (to - from);
+}
+
+typedef struct {
+    VolumeType volume;
+    Ray ray;
+    float3 mic_reflection;
+    float distance;
+    unsigned long ray_index;
+    int active;
+} RayState;
+
+typedef struct {
+    unsigned int key;
+    unsigned int index;
+} RayKey;
+
+RayState new_ray_state
+(   float3 source
+,   float3 direction
+,   float3 position
+,   unsigned long ray_index
+);
+RayState new_ray_state
+(   float3 source
+,   float3 direction
+,   float3 position
+,   unsigned long ray_index
+)
+{
+    return (RayState)
+    {   (VolumeType) (1)
+    ,   {source, direction}
+    ,   position
+    ,   0
+    ,   ray_index
+    ,   true
+    };
+}
+
+)"
+    "#define SCENE_SPACE global\n"
+    "#define SCENE_FUNCTION(name) name\n" +
+    scene_functions +
+    "#undef SCENE_SPACE\n"
+    "#undef SCENE_FUNCTION\n"
+    "#define SCENE_SPACE local\n"
+    "#define SCENE_FUNCTION(name) name##_local\n" +
+    scene_functions +
+    "#undef SCENE_SPACE\n"
+    "#undef SCENE_FUNCTION\n"
+    R"(
+
+kernel void raytrace
+(   global float3 * directions
+,   float3 position
+,   global Triangle * triangles
+,   unsigned long numtriangles
+,   global float3 * vertices
+,   global Triangle * lod_triangles
+,   global float3 * lod_vertices
+,   global LodRange * lod_ranges
+,   float3 source
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   unsigned long outputOffset
+,   VolumeType AIR_COEFFICIENT
+,   float receiver_radius
+,   global uchar * receiver_visibility
+,   uint visibility_resolution
+)
+{
+    size_t i = get_global_id (0);
+    trace_ray
+    (   i
+    ,   directions [i]
+    ,   position
+    ,   triangles
+    ,   numtriangles
+    ,   vertices
+    ,   lod_triangles
+    ,   lod_vertices
+    ,   lod_ranges
+    ,   source
+    ,   surfaces
+    ,   impulses
+    ,   image_source
+    ,   image_source_index
+    ,   outputOffset
+    ,   AIR_COEFFICIENT
+    ,   receiver_radius
+    ,   receiver_visibility
+    ,   visibility_resolution
+    );
+}
+
+//  Identical to the raytrace kernel, but the scene geometry is first copied
+//  into local memory by each work-group.
+//  Only suitable for scenes small enough to fit in local memory.
+kernel void raytrace_local
+(   global float3 * directions
+,   float3 position
+,   global Triangle * global_triangles
+,   unsigned long numtriangles
+,   global float3 * global_vertices
+,   unsigned long numvertices
+,   local Triangle * triangles
+,   local float3 * vertices
+,   global Triangle * lod_triangles
+,   global float3 * lod_vertices
+,   global LodRange * lod_ranges
+,   float3 source
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   unsigned long outputOffset
+,   VolumeType AIR_COEFFICIENT
+,   float receiver_radius
+,   global uchar * receiver_visibility
+,   uint visibility_resolution
+)
+{
+    for (size_t j = get_local_id (0); j < numtriangles; j += get_local_size (0))
+    {
+        triangles [j] = global_triangles [j];
+    }
+
+    for (size_t j = get_local_id (0); j < numvertices; j += get_local_size (0))
+    {
+        vertices [j] = global_vertices [j];
+    }
+
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    size_t i = get_global_id (0);
+    trace_ray_local
+    (   i
+    ,   directions [i]
+    ,   position
+    ,   triangles
+    ,   numtriangles
+    ,   vertices
+    ,   lod_triangles
+    ,   lod_vertices
+    ,   lod_ranges
+    ,   source
+    ,   surfaces
+    ,   impulses
+    ,   image_source
+    ,   image_source_index
+    ,   outputOffset
+    ,   AIR_COEFFICIENT
+    ,   receiver_radius
+    ,   receiver_visibility
+    ,   visibility_resolution
+    );
+}
+
+//  The kernels below find image sources deterministically, by expanding a
+//  tree of image sources one reflection order at a time and then validating
+//  the path from every image source to the receiver.
+
+#define NO_TRIANGLE (UINT_MAX)
+
+typedef struct {
+    float3 image;
+    uint parent;
+    uint triangle;
+    uint order;
+} ImageSourceNode;
+
+//  True if the image of parent in triangle triangle_index is a child of
+//  parent in the tree.
+bool image_source_keeps
+(   ImageSourceNode parent
+,   uint triangle_index
+,   global Triangle * triangles
+,   global float3 * vertices
+)
+{
+    if (triangle_index == parent.triangle)
+    {
+        return false;
+    }
+
+    global Triangle * triangle = triangles + triangle_index;
+    TriangleVerts current =
+    {   vertices [triangle->v0]
+    ,   vertices [triangle->v1]
+    ,   vertices [triangle->v2]
+    };
+
+    //  The image can't be mirrored in a plane which it lies on.
+    const float3 normal = triangle_verts_normal (&current);
+    if (fabs (dot (normal, parent.image - current.v0)) < EPSILON)
+    {
+        return false;
+    }
+
+    //  The parent image lies behind its reflector, so the reflector can only
+    //  see triangles which are at least partly in front of it.
+    if (parent.triangle != NO_TRIANGLE)
+    {
+        global Triangle * reflector = triangles + parent.triangle;
+        TriangleVerts r =
+        {   vertices [reflector->v0]
+        ,   vertices [reflector->v1]
+        ,   vertices [reflector->v2]
+        };
+        const float3 n = triangle_verts_normal (&r);
+        const float behind = dot (n, parent.image - r.v0) < 0 ? -1 : 1;
+        return
+            dot (n, current.v0 - r.v0) * behind < -EPSILON
+        ||  dot (n, current.v1 - r.v0) * behind < -EPSILON
+        ||  dot (n, current.v2 - r.v0) * behind < -EPSILON;
+    }
+
+    return true;
+}
+
+//  Counts the children of each parent, so that the host can give every
+//  parent a fixed range of the next order.
+kernel void image_source_count
+(   global ImageSourceNode * nodes
+,   uint parent_begin
+,   global Triangle * triangles
+,   unsigned long numtriangles
+,   global float3 * vertices
+,   global uint * counts
+)
+{
+    const size_t i = get_global_id (0);
+    const ImageSourceNode parent = nodes [parent_begin + i];
+
+    uint count = 0;
+    for (uint t = 0; t != numtriangles; ++t)
+    {
+        if (image_source_keeps (parent, t, triangles, vertices))
+        {
+            count += 1;
+        }
+    }
+    counts [i] = count;
+}
+
+//  Writes the children of each parent from offsets [i], in triangle order,
+//  so the tree is laid out the same way on every run.
+//  Children at or beyond capacity are dropped, which always drops the same
+//  ones.
+kernel void image_source_expand
+(   global ImageSourceNode * nodes
+,   uint parent_begin
+,   uint child_begin
+,   global Triangle * triangles
+,   unsigned long numtriangles
+,   global float3 * vertices
+,   global uint * offsets
+,   uint capacity
+)
+{
+    const size_t i = get_global_id (0);
+    const uint parent_index = parent_begin + i;
+    const ImageSourceNode parent = nodes [parent_index];
+
+    uint child = offsets [i];
+    for (uint t = 0; t != numtriangles && child < capacity; ++t)
+    {
+        if (image_source_keeps (parent, t, triangles, vertices))
+        {
+            global Triangle * triangle = triangles + t;
+            TriangleVerts current =
+            {   vertices [triangle->v0]
+            ,   vertices [triangle->v1]
+            ,   vertices [triangle->v2]
+            };
+
+            float3 image = parent.image;
+            mirror_point (&image, &current);
+            nodes [child_begin + child] = (ImageSourceNode)
+            {   image
+            ,   parent_index
+            ,   t
+            ,   parent.order + 1
+            };
+            child += 1;
+        }
+    }
+}
+
+kernel void image_source_validate
+(   global ImageSourceNode * nodes
+,   float3 position
+,   global Triangle * triangles
+,   unsigned long numtriangles
+,   global float3 * vertices
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global unsigned long * paths
+,   VolumeType AIR_COEFFICIENT
+)
+{
+    const size_t i = get_global_id (0);
+    const ImageSourceNode leaf = nodes [i];
+    global unsigned long * path = paths + i * NUM_IMAGE_SOURCE;
+
+    //  Walk from the receiver back towards the source, checking that each
+    //  reflection point lies on its reflector and isn't occluded.
+    ImageSourceNode node = leaf;
+    float3 point = position;
+    VolumeType volume = (VolumeType) (1);
+    bool valid = true;
+    for (uint order = leaf.order; order != 0 && valid; --order)
+    {
+        global Triangle * triangle = triangles + node.triangle;
+        TriangleVerts current =
+        {   vertices [triangle->v0]
+        ,   vertices [triangle->v1]
+        ,   vertices [triangle->v2]
+        };
+
+        Ray ray = {point, normalize (node.image - point)};
+        const float distance = triangle_vert_intersection (&current, &ray);
+        Intersection closest = ray_triangle_intersection
+        (   &ray
+        ,   triangles
+        ,   numtriangles
+        ,   vertices
+        );
+
+        valid =
+            EPSILON < distance
+        &&  closest.intersects
+        &&  distance - EPSILON < closest.distance;
+
+        point = ray.position + ray.direction * distance;
+
+        //  Ray-based discovery adds each image with the volume of the ray
+        //  before its final reflection, so the reflector nearest the receiver
+        //  is left out here too, and both methods give the same levels.
+        if (order != leaf.order)
+        {
+            volume *= -surfaces [triangle->surface].specular;
+        }
+        path [order] = node.triangle + 1;
+        node = nodes [node.parent];
+    }
+
+    valid = valid && point_intersection
+    (   point
+    ,   node.image
+    ,   triangles
+    ,   numtriangles
+    ,   vertices
+    );
+
+    const float distance = length (leaf.image - position);
+    impulses [i] = (Impulse)
+    {   volume * attenuation_for_distance (distance, AIR_COEFFICIENT)
+    ,   leaf.image
+    ,   SECONDS_PER_METER * distance
+    };
+    path [0] = valid ? 0 : ULONG_MAX;
+}
+
+kernel void receiver_visibility_map
+(   float3 position
+,   global Triangle * triangles
+,   unsigned long numtriangles
+,   global float3 * vertices
+,   global uchar * visibility
+,   uint resolution
+)
+{
+    const size_t i = get_global_id (0);
+    const size_t cells = resolution * resolution;
+    const uint cell = i % cells;
+    const uint a = cell / resolution;
+    const uint b = cell % resolution;
+
+    if (resolution <= a + b)
+    {
+        visibility [i] = 0;
+        return;
+    }
+
+    global Triangle * triangle = triangles + i / cells;
+    TriangleVerts current =
+    {   vertices [triangle->v0]
+    ,   vertices [triangle->v1]
+    ,   vertices [triangle->v2]
+    };
+
+    visibility [i] = point_intersection
+    (   visibility_cell_point (&current, a, b, resolution)
+    ,   position
+    ,   triangles
+    ,   numtriangles
+    ,   vertices
+    );
+}
+
+typedef struct {
+    float3 position;
+    float3 source;
+    unsigned long triangle_offset;
+    unsigned long numtriangles;
+} BatchJob;
+
+//  Traces several jobs at once, each with its own mic, source, and scene.
+//  The scenes are concatenated, with vertex and surface indices already
+//  offset, so each job only needs to know which range of triangles is its own.
+//  Work-items are arranged as (ray, job).
+kernel void raytrace_batch
+(   global float3 * directions
+,   global BatchJob * jobs
+,   global Triangle * triangles
+,   global float3 * vertices
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   unsigned long outputOffset
+,   VolumeType AIR_COEFFICIENT
+)
+{
+    const size_t ray = get_global_id (0);
+    const size_t i = get_global_id (1) * get_global_size (0) + ray;
+    global BatchJob * job = jobs + get_global_id (1);
+
+    trace_ray
+    (   i
+    ,   directions [ray]
+    ,   job->position
+    ,   triangles + job->triangle_offset
+    ,   job->numtriangles
+    ,   vertices
+    ,   NULL
+    ,   NULL
+    ,   NULL
+    ,   job->source
+    ,   surfaces
+    ,   impulses
+    ,   image_source
+    ,   image_source_index
+    ,   outputOffset
+    ,   AIR_COEFFICIENT
+    ,   0
+    ,   NULL
+    ,   0
+    );
+}
+
+//  The kernels below trace rays one reflection at a time, so that the rays can
+//  be reordered between reflections.
+//  Ray state is kept in global memory in between kernel invocations.
+
+kernel void init_rays
+(   global float3 * directions
+,   float3 position
+,   global Triangle * triangles
+,   unsigned long numtriangles
+,   global float3 * vertices
+,   float3 source
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   global RayState * states
+,   VolumeType AIR_COEFFICIENT
+)
+{
+    size_t i = get_global_id (0);
+
+    states [i] = new_ray_state (source, directions [i], position, i);
+
+    add_direct_image
+    (   position
+    ,   source
+    ,   triangles
+    ,   numtriangles
+    ,   vertices
+    ,   image_source
+    ,   image_source_index
+    ,   i
+    ,   AIR_COEFFICIENT
+    );
+}
+
+kernel void raytrace_step
+(   global RayState * states
+,   global TriangleVerts * ray_primitives
+,   unsigned long index
+,   float3 position
+,   global Triangle * triangles
+,   unsigned long numtriangles
+,   global float3 * vertices
+,   global Triangle * lod_triangles
+,   global float3 * lod_vertices
+,   global LodRange * lod_ranges
+,   float3 source
+,   global Surface * surfaces
+,   global Impulse * impulses
+,   global Impulse * image_source
+,   global unsigned long * image_source_index
+,   unsigned long outputOffset
+,   VolumeType AIR_COEFFICIENT
+,   float receiver_radius
+,   global uchar * receiver_visibility
+,   uint visibility_resolution
+)
+{
+    size_t i = get_global_id (0);
+    RayState state = states [i];
+
+    if (! state.active)
+    {
+        return;
+    }
+
+    //  The reflecting primitives are stored per-ray rather than per-thread,
+    //  so that they don't have to be moved around when the rays are sorted.
+    global TriangleVerts * stored =
+        ray_primitives + state.ray_index * (NUM_IMAGE_SOURCE - 1);
+    TriangleVerts prev_primitives [NUM_IMAGE_SOURCE - 1];
+    const bool IMAGE_SOURCE = image_source && index < NUM_IMAGE_SOURCE - 1;
+
+    if (IMAGE_SOURCE)
+    {
+        for (unsigned long k = 0; k != index; ++k)
+        {
+            prev_primitives [k] = stored [k];
+        }
+    }
+
+    state.active = trace_reflection_lod
+    (   &state
+    ,   prev_primitives
+    ,   index
+    ,   position
+    ,   triangles
+    ,   numtriangles
+    ,   vertices
+    ,   lod_triangles
+    ,   lod_vertices
+    ,   lod_ranges
+    ,   source
+    ,   surfaces
+    ,   impulses
+    ,   image_source
+    ,   image_source_index
+    ,   outputOffset
+    ,   AIR_COEFFICIENT
+    ,   receiver_radius
+    ,   receiver_visibility
+    ,   visibility_resolution
+    );
+
+    if (IMAGE_SOURCE && state.active)
+    {
+        stored [index] = prev_primitives [index];
+    }
+
+    states [i] = state;
+}
+
+//  Spread the low 9 bits of an integer so that there are two zero bits
+//  between each of the original bits.
+unsigned int spread_bits (unsigned int x);
+unsigned int spread_bits (unsigned int x)
+{
+    x &= 0x1ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+unsigned int morton_code (float3 p);
+unsigned int morton_code (float3 p)
+{
+    uint3 q = convert_uint3 (clamp (p, 0.0f, 1.0f) * 511.0f);
+    return (spread_bits (q.x) << 2) | (spread_bits (q.y) << 1) | spread_bits (q.z);
+}
+
+//  Rays are keyed first by the octant of their direction, then by the position
+//  of their origin along a z-order curve.
+//  Inactive rays are keyed so that they sort to the end of the array.
+kernel void ray_keys
+(   global RayState * states
+,   global RayKey * keys
+,   float3 bounds_min
+,   float3 bounds_max
+)
+{
+    size_t i = get_global_id (0);
+    global RayState * state = states + i;
+
+    unsigned int key = UINT_MAX;
+    if (state->active)
+    {
+        const float3 d = state->ray.direction;
+        const unsigned int octant =
+            (d.x < 0 ? 4 : 0) | (d.y < 0 ? 2 : 0) | (d.z < 0 ? 1 : 0);
+        const float3 origin =
+            (state->ray.position - bounds_min)
+        /   max (bounds_max - bounds_min, EPSILON);
+        key = (octant << 27) | morton_code (origin);
+    }
+
+    keys [i] = (RayKey) {key, i};
+}
+
+//  A single pass of a bitonic sort.
+//  The number of keys must be a power of two.
+kernel void sort_ray_keys
+(   global RayKey * keys
+,   unsigned int j
+,   unsigned int k
+)
+{
+    size_t i = get_global_id (0);
+    size_t ixj = i ^ j;
+
+    if (ixj > i)
+    {
+        const RayKey a = keys [i];
+        const RayKey b = keys [ixj];
+        const bool ascending = (i & k) == 0;
+        if ((a.key > b.key) == ascending)
+        {
+            keys [i] = b;
+            keys [ixj] = a;
+        }
+    }
+}
+
+kernel void permute_rays
+(   global RayState * in
+,   global RayKey * keys
+,   global RayState * out
+)
+{
+    size_t i = get_global_id (0);
+    out [i] = in [keys [i].index];
+}
 
 float speaker_attenuation (Speaker * speaker, float3 direction);
 float speaker_attenuation (Speaker * speaker, float3 direction)
@@ -10,6 +10,51 @@ public:
     RayverbProgram(const cl::Context & context, bool build_immediate = false);
 
     auto get_raytrace_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl_float3,
+                               cl::Buffer,
+                               cl_ulong,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl_float3,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl_ulong,
+                               VolumeType,
+                               cl_float,
+                               cl::Buffer,
+                               cl_uint>(*this, "raytrace");
+    }
+
+    auto get_raytrace_local_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl_float3,
+                               cl::Buffer,
+                               cl_ulong,
+                               cl::Buffer,
+                               cl_ulong,
+                               cl::LocalSpaceArg,
+                               cl::LocalSpaceArg,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl_float3,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl_ulong,
+                               VolumeType,
+                               cl_float,
+                               cl::Buffer,
+                               cl_uint>(*this, "raytrace_local");
+    }
+
+    auto get_init_rays_kernel() const {
         return cl::make_kernel<cl::Buffer,
                                cl_float3,
                                cl::Buffer,
@@ -19,9 +64,99 @@ public:
                                cl::Buffer,
                                cl::Buffer,
                                cl::Buffer,
+                               VolumeType>(*this, "init_rays");
+    }
+
+    auto get_raytrace_step_kernel() const {
+        return cl::make_kernel<cl::Buffer,
                                cl::Buffer,
                                cl_ulong,
-                               VolumeType>(*this, "raytrace");
+                               cl_float3,
+                               cl::Buffer,
+                               cl_ulong,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl_float3,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl_ulong,
+                               VolumeType,
+                               cl_float,
+                               cl::Buffer,
+                               cl_uint>(*this, "raytrace_step");
+    }
+
+    auto get_raytrace_batch_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl_ulong,
+                               VolumeType>(*this, "raytrace_batch");
+    }
+
+    auto get_image_source_count_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl_uint,
+                               cl::Buffer,
+                               cl_ulong,
+                               cl::Buffer,
+                               cl::Buffer>(*this, "image_source_count");
+    }
+
+    auto get_image_source_expand_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl_uint,
+                               cl_uint,
+                               cl::Buffer,
+                               cl_ulong,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl_uint>(*this, "image_source_expand");
+    }
+
+    auto get_image_source_validate_kernel() const {
+        return cl::make_kernel<cl::Buffer,
+                               cl_float3,
+                               cl::Buffer,
+                               cl_ulong,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl::Buffer,
+                               VolumeType>(*this, "image_source_validate");
+    }
+
+    auto get_receiver_visibility_map_kernel() const {
+        return cl::make_kernel<cl_float3,
+                               cl::Buffer,
+                               cl_ulong,
+                               cl::Buffer,
+                               cl::Buffer,
+                               cl_uint>(*this, "receiver_visibility_map");
+    }
+
+    auto get_ray_keys_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl::Buffer, cl_float3, cl_float3>(
+            *this, "ray_keys");
+    }
+
+    auto get_sort_ray_keys_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl_uint, cl_uint>(*this,
+                                                             "sort_ray_keys");
+    }
+
+    auto get_permute_rays_kernel() const {
+        return cl::make_kernel<cl::Buffer, cl::Buffer, cl::Buffer>(
+            *this, "permute_rays");
     }
 
     auto get_attenuate_kernel() const {
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cmath>
+#include <string>
+
+//  The weighting used by the sphere receiver, written in the common subset of
+//  C++ and OpenCL C.
+//  The macro compiles the functions on the host, so that they can be tested
+//  without a device, and also keeps their text in sphere_receiver_source,
+//  which is prepended to the kernel source.
+#define SPHERE_RECEIVER_FUNCTIONS(...) \
+    __VA_ARGS__                        \
+    static const std::string sphere_receiver_source{#__VA_ARGS__};
+
+SPHERE_RECEIVER_FUNCTIONS(
+    //  The length of a ray segment inside the receiver sphere, given the
+    //  distance along the ray to the point closest to the centre and the
+    //  squared distance from that point to the centre.
+    static inline float sphere_receiver_chord(float closest,
+                                              float miss_squared,
+                                              float segment_length,
+                                              float receiver_radius) {
+        const float radius_squared = receiver_radius * receiver_radius;
+        if (radius_squared <= miss_squared)
+            return 0;
+        const float half_chord = sqrt(radius_squared - miss_squared);
+        return fmax(fmin(closest + half_chord, segment_length) -
+                        fmax(closest - half_chord, 0.0f),
+                    0.0f);
+    }
+
+    //  The chord through the sphere over the sphere's volume estimates the
+    //  energy density of the rays crossing it, whatever its radius.
+    //  Multiplying by 4 pi makes the sum over a bundle of rays match one
+    //  contribution per ray at 1m from where the rays diverged.
+    static inline float sphere_receiver_weight(float chord,
+                                               float receiver_radius) {
+        return 3 * chord /
+               (receiver_radius * receiver_radius * receiver_radius);
+    })
@@ -0,0 +1,238 @@
+#include "rayverb.h"
+#include "device_tests.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+using namespace std;
+
+/// A closed box from the origin to size, with every face using one surface.
+SceneData box_scene(const Vec3f & size) {
+    vector<cl_float3> vertices;
+    for (auto i = 0; i != 8; ++i) {
+        vertices.push_back(cl_float3{{i & 1 ? size.x : 0,
+                                      i & 2 ? size.y : 0,
+                                      i & 4 ? size.z : 0}});
+    }
+
+    vector<Triangle> triangles;
+    for (const auto & f : vector<array<cl_ulong, 4>>{{{0, 1, 3, 2}},
+                                                     {{4, 6, 7, 5}},
+                                                     {{0, 4, 5, 1}},
+                                                     {{2, 3, 7, 6}},
+                                                     {{0, 2, 6, 4}},
+                                                     {{1, 5, 7, 3}}}) {
+        triangles.push_back(Triangle{0, f[0], f[1], f[2]});
+        triangles.push_back(Triangle{0, f[0], f[2], f[3]});
+    }
+
+    Surface surface;
+    for (auto i = 0u; i != 8; ++i) {
+        surface.specular.s[i] = 0.9;
+        surface.diffuse.s[i] = 0.1;
+    }
+    return SceneData(triangles, vertices, {surface});
+}
+
+/// Evenly spread directions, so that both raytracers see the same rays.
+vector<cl_float3> spiral_directions(unsigned count) {
+    vector<cl_float3> ret;
+    const auto golden_angle = M_PI * (3 - sqrt(5.0));
+    for (auto i = 0u; i != count; ++i) {
+        auto z = 1 - (2 * i + 1.0) / count;
+        auto r = sqrt(1 - z * z);
+        auto theta = golden_angle * i;
+        ret.push_back(cl_float3{{cl_float(r * cos(theta)),
+                                 cl_float(r * sin(theta)),
+                                 cl_float(z)}});
+    }
+    return ret;
+}
+
+TEST(batch_raytrace, matches_sequential) {
+    if (!has_opencl_platform()) {
+        cerr << "no OpenCL platform, skipping batch raytrace test" << endl;
+        return;
+    }
+
+    auto context = get_context();
+    auto device = get_device(context);
+    cl::CommandQueue queue(context, device);
+    auto program = get_program<RayverbProgram>(context, device);
+
+    const auto nreflections = 16u;
+    vector<SceneData> scenes{box_scene(Vec3f(4, 3, 5)),
+                             box_scene(Vec3f(2, 2.5, 3))};
+    vector<BatchRaytrace::Job> jobs{{0, {{1, 1, 1}}, {{3, 2, 4}}},
+                                    {1, {{0.5, 1, 0.5}}, {{1.5, 1, 2}}},
+                                    {0, {{2, 1.5, 1}}, {{3, 2, 4}}}};
+    auto directions = spiral_directions(1 << 12);
+
+    BatchRaytrace batch(program, queue, nreflections, scenes);
+    batch.raytrace(jobs, directions);
+    auto batch_results = batch.getAllRaw(false);
+    ASSERT_EQ(jobs.size(), batch_results.size());
+
+    for (auto j = 0u; j != jobs.size(); ++j) {
+        Raytrace raytrace(program, queue, nreflections, scenes[jobs[j].scene]);
+        raytrace.setUseLocalMemory(false);
+        raytrace.raytrace(jobs[j].mic, jobs[j].source, directions);
+        auto expected = raytrace.getAllRaw(false).impulses;
+        const auto & actual = batch_results[j].impulses;
+
+        ASSERT_EQ(expected.size(), actual.size());
+        for (auto i = 0u; i != expected.size(); ++i) {
+            ASSERT_NEAR(expected[i].time, actual[i].time, 1e-5);
+            for (auto band = 0u; band != 8; ++band) {
+                ASSERT_NEAR(expected[i].volume.s[band],
+                            actual[i].volume.s[band],
+                            1e-5);
+            }
+        }
+    }
+}
+
+TEST(sorted_raytrace, matches_unsorted) {
+    if (!has_opencl_platform()) {
+        cerr << "no OpenCL platform, skipping sorted raytrace test" << endl;
+        return;
+    }
+
+    auto context = get_context();
+    auto device = get_device(context);
+    cl::CommandQueue queue(context, device);
+    auto program = get_program<RayverbProgram>(context, device);
+
+    const auto nreflections = 16u;
+    auto scene = box_scene(Vec3f(4, 3, 5));
+    cl_float3 mic{{1, 1, 1}};
+    cl_float3 source{{3, 2, 4}};
+    auto directions = spiral_directions(1 << 12);
+
+    Raytrace unsorted(program, queue, nreflections, scene);
+    unsorted.setSortRays(false);
+    unsorted.raytrace(mic, source, directions);
+    auto expected = unsorted.getAllRaw(false).impulses;
+
+    Raytrace sorted(program, queue, nreflections, scene);
+    sorted.setSortRays(true);
+    sorted.raytrace(mic, source, directions);
+    auto actual = sorted.getAllRaw(false).impulses;
+
+    ASSERT_EQ(expected.size(), actual.size());
+    for (auto i = 0u; i != expected.size(); ++i) {
+        ASSERT_NEAR(expected[i].time, actual[i].time, 1e-5);
+        for (auto band = 0u; band != 8; ++band) {
+            ASSERT_NEAR(expected[i].volume.s[band],
+                        actual[i].volume.s[band],
+                        1e-5);
+        }
+    }
+}
+
+TEST(visibility_map, matches_visibility_rays) {
+    if (!has_opencl_platform()) {
+        cerr << "no OpenCL platform, skipping visibility map test" << endl;
+        return;
+    }
+
+    auto context = get_context();
+    auto device = get_device(context);
+    cl::CommandQueue queue(context, device);
+    auto program = get_program<RayverbProgram>(context, device);
+
+    const auto nreflections = 16u;
+    auto scene = box_scene(Vec3f(4, 3, 5));
+    cl_float3 mic{{1, 1, 1}};
+    cl_float3 source{{3, 2, 4}};
+    auto directions = spiral_directions(1 << 12);
+
+    Raytrace rays(program, queue, nreflections, scene);
+    rays.raytrace(mic, source, directions);
+    auto expected = rays.getRawDiffuse().impulses;
+
+    Raytrace mapped(program, queue, nreflections, scene);
+    mapped.setVisibilityMapResolution(32);
+    mapped.raytrace(mic, source, directions);
+    ASSERT_TRUE(mapped.hasVisibilityMap(mic));
+    auto actual = mapped.getRawDiffuse().impulses;
+
+    //  cells on the edge of a shadow may be registered differently, so
+    //  only the total diffuse energy in each band has to be close
+    ASSERT_EQ(expected.size(), actual.size());
+    for (auto band = 0u; band != 8; ++band) {
+        auto expected_total = 0.0, actual_total = 0.0;
+        for (auto i = 0u; i != expected.size(); ++i) {
+            expected_total += expected[i].volume.s[band];
+            actual_total += actual[i].volume.s[band];
+        }
+        ASSERT_LT(0, expected_total);
+        ASSERT_NEAR(expected_total, actual_total, 0.01 * expected_total);
+    }
+
+    //  moving the mic rebuilds the map
+    cl_float3 moved{{2, 1.5, 1}};
+    ASSERT_FALSE(mapped.hasVisibilityMap(moved));
+    mapped.prepareVisibilityMap(moved);
+    ASSERT_TRUE(mapped.hasVisibilityMap(moved));
+    ASSERT_FALSE(mapped.hasVisibilityMap(mic));
+
+    //  changing the geometry invalidates it
+    mapped.updateVertices(0, {cl_float3{{0, 0, 0}}});
+    ASSERT_FALSE(mapped.hasVisibilityMap(moved));
+    mapped.prepareVisibilityMap(moved);
+    ASSERT_TRUE(mapped.hasVisibilityMap(moved));
+}
+
+TEST(image_source_tree, finds_ray_paths) {
+    if (!has_opencl_platform()) {
+        cerr << "no OpenCL platform, skipping image-source tree test" << endl;
+        return;
+    }
+
+    auto context = get_context();
+    auto device = get_device(context);
+    cl::CommandQueue queue(context, device);
+    auto program = get_program<RayverbProgram>(context, device);
+
+    //  rays reflecting twice only find paths up to order 2
+    const auto nreflections = 2u;
+    auto scene = box_scene(Vec3f(4, 3, 5));
+    cl_float3 mic{{1, 1, 1}};
+    cl_float3 source{{3, 2, 4}};
+    auto directions = spiral_directions(1 << 16);
+
+    Raytrace rays(program, queue, nreflections, scene);
+    rays.raytrace(mic, source, directions);
+    auto found = rays.getRawImages(false).impulses;
+
+    Raytrace tree(program, queue, nreflections, scene);
+    tree.setImageSourceOrder(2);
+    tree.raytrace(mic, source, directions);
+    auto expected = tree.getRawImages(false).impulses;
+
+    ASSERT_FALSE(found.empty());
+    ASSERT_LE(found.size(), expected.size());
+
+    //  the two methods record different positions for an image, so paths
+    //  are matched by arrival time and level
+    auto same_path = [](const Impulse & a, const Impulse & b) {
+        if (1e-5 < fabs(a.time - b.time))
+            return false;
+        for (auto band = 0u; band != 8; ++band) {
+            if (1e-5 < fabs(a.volume.s[band] - b.volume.s[band]))
+                return false;
+        }
+        return true;
+    };
+
+    for (const auto & i : found) {
+        EXPECT_TRUE(any_of(begin(expected),
+                           end(expected),
+                           [&](const auto & j) { return same_path(i, j); }))
+            << "no image source arrives at " << i.time;
+    }
+}
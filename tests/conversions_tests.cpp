@@ -0,0 +1,32 @@
+#include "conversions.h"
+
+#include "gtest/gtest.h"
+
+#include <cmath>
+
+TEST(conversions, half_round_trip) {
+    for (auto i = 0u; i != 1u << 16; ++i) {
+        cl_half h = i;
+        auto f = half_to_float(h);
+        if (std::isnan(f))
+            ASSERT_TRUE(std::isnan(half_to_float(float_to_half(f))));
+        else
+            ASSERT_EQ(h, float_to_half(f));
+    }
+}
+
+TEST(conversions, half_rounding) {
+    //  ties round to even
+    ASSERT_EQ(0x3c00, float_to_half(1 + std::ldexp(1.0f, -11)));
+    ASSERT_EQ(0x3c02, float_to_half(1 + 3 * std::ldexp(1.0f, -11)));
+    ASSERT_EQ(0x3c01, float_to_half(1 + 1.5f * std::ldexp(1.0f, -11)));
+
+    ASSERT_EQ(0x7bff, float_to_half(65519));
+    ASSERT_EQ(0x7c00, float_to_half(65520));
+    ASSERT_EQ(0xfc00, float_to_half(-1e10f));
+
+    ASSERT_EQ(0x0001, float_to_half(std::ldexp(1.0f, -24)));
+    ASSERT_EQ(0x0000, float_to_half(std::ldexp(1.0f, -25)));
+    ASSERT_EQ(0x0001, float_to_half(std::ldexp(1.5f, -25)));
+    ASSERT_EQ(0x0400, float_to_half(std::ldexp(1023.5f, -24)));
+}
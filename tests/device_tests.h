@@ -0,0 +1,15 @@
+#pragma once
+
+#include "cl_common.h"
+
+/// Tests which need an OpenCL device pass without checking anything if there
+/// is no OpenCL platform.
+inline bool has_opencl_platform() {
+    try {
+        vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        return !platforms.empty();
+    } catch (const cl::Error &) {
+        return false;
+    }
+}
@@ -0,0 +1,52 @@
+#include "distributed_waveguide.h"
+#include "native_waveguide.h"
+#include "device_tests.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+TEST(distributed_waveguide, matches_native) {
+    if (!has_opencl_platform()) {
+        cerr << "no OpenCL platform, skipping distributed waveguide test"
+             << endl;
+        return;
+    }
+
+    auto context = get_context();
+    auto device = get_device(context);
+    auto program = get_program<TetrahedralProgram>(context, device);
+
+    SphereBoundary boundary(Vec3f(0), 1);
+    NativeTetrahedralWaveguide native(boundary, 0.1, 1);
+    auto source = native.get_index_for_coordinate(Vec3f(0.2, 0, 0));
+    vector<size_t> receivers{
+        native.get_index_for_coordinate(Vec3f(0, 0, -0.7)),
+        native.get_index_for_coordinate(Vec3f(0, 0.1, 0.6)),
+        source};
+
+    auto steps = 100u;
+    auto expected = native.run(source, receivers, steps);
+
+    //  slabs on separate queues of one device go through the same exchange
+    //  as slabs on separate devices
+    for (auto count : {1u, 3u, 7u}) {
+        vector<TetrahedralProgram> programs(count, program);
+        vector<cl::CommandQueue> queues;
+        for (auto i = 0u; i != count; ++i)
+            queues.emplace_back(context, device);
+
+        DistributedTetrahedralWaveguide waveguide(
+            programs, queues, boundary, 0.1);
+        //  100 steps in chunks of 7 leaves a short last chunk
+        waveguide.set_steps_per_sync(7);
+        auto actual = waveguide.run(source, receivers, steps);
+
+        ASSERT_EQ(expected.size(), actual.size());
+        for (auto r = 0u; r != expected.size(); ++r) {
+            ASSERT_EQ(expected[r].size(), actual[r].size());
+            for (auto i = 0u; i != expected[r].size(); ++i)
+                ASSERT_NEAR(expected[r][i], actual[r][i], 1e-5);
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#include "iterative_tetrahedral_mesh.h"
+#include "rectilinear_mesh.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+
+using namespace std;
+
+TEST(mesh, compacted) {
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralMesh mesh(boundary, 0.1);
+
+    ASSERT_LT(mesh.nodes.size(), mesh.index_map.size());
+    for (const auto & node : mesh.nodes)
+        ASSERT_TRUE(node.inside);
+
+    //  every connection should still be reciprocal after remapping
+    for (auto i = 0u; i != mesh.nodes.size(); ++i) {
+        for (auto port : mesh.nodes[i].ports) {
+            if (port < 0)
+                continue;
+            ASSERT_LT(port, static_cast<int>(mesh.nodes.size()));
+            const auto & ports = mesh.nodes[port].ports;
+            ASSERT_NE(end(ports), find(begin(ports), end(ports), i));
+        }
+    }
+}
+
+TEST(mesh, node_index) {
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralMesh mesh(boundary, 0.1);
+
+    auto index = mesh.get_node_index(mesh.get_locator(Vec3f(0)));
+    ASSERT_LE(0, index);
+    auto position = mesh.nodes[index].position;
+    ASSERT_LT((Vec3f(position.s[0], position.s[1], position.s[2])).mag(), 0.1);
+
+    auto corner = mesh.get_locator(Vec3f(0.99, 0.99, 0.99));
+    ASSERT_EQ(-1, mesh.get_node_index(corner));
+
+    ASSERT_EQ(size_t(index), mesh.get_node_index_for_coordinate(Vec3f(0)));
+    ASSERT_THROW(mesh.get_node_index_for_coordinate(Vec3f(0.99, 0.99, 0.99)),
+                 runtime_error);
+}
+
+TEST(mesh, morton_order) {
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralMesh grid(boundary, 0.1);
+    IterativeTetrahedralMesh morton(boundary, 0.1, true);
+
+    ASSERT_EQ(grid.nodes.size(), morton.nodes.size());
+    ASSERT_NE(grid.index_map, morton.index_map);
+
+    //  the same nodes should be connected, whatever order they're stored in
+    for (auto i = 0u; i != grid.index_map.size(); ++i) {
+        auto a = grid.index_map[i];
+        auto b = morton.index_map[i];
+        ASSERT_EQ(a < 0, b < 0);
+        if (a < 0)
+            continue;
+        for (auto j = 0; j != IterativeTetrahedralMesh::PORTS; ++j) {
+            auto grid_port = grid.nodes[a].ports[j];
+            auto morton_port = morton.nodes[b].ports[j];
+            ASSERT_EQ(grid_port < 0, morton_port < 0);
+            if (grid_port >= 0) {
+                auto p = grid.nodes[grid_port].position;
+                auto q = morton.nodes[morton_port].position;
+                ASSERT_TRUE((Vec3f(p.s[0], p.s[1], p.s[2]) ==
+                             Vec3f(q.s[0], q.s[1], q.s[2]))
+                                .all());
+            }
+        }
+    }
+}
+
+TEST(mesh, tile_steps) {
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralMesh mesh(boundary, 0.1);
+    vector<int> local(mesh.nodes.size(), -1);
+    auto tile = mesh.get_tile(100, 200, 3, local);
+    ASSERT_EQ(4u, tile.within.size());
+
+    //  a shorter block stops early, but still starts from the full halo
+    for (auto length : {3u, 2u}) {
+        vector<size_t> valid;
+        tile.step(length, [&](auto v, auto step) {
+            ASSERT_EQ(valid.size(), step);
+            valid.push_back(v);
+        });
+        vector<size_t> expected{tile.within[2], tile.within[1], tile.within[0]};
+        expected.resize(length);
+        ASSERT_EQ(expected, valid);
+    }
+}
+
+TEST(rectilinear_mesh, locators) {
+    SphereBoundary boundary(Vec3f(0), 1);
+    RectilinearMesh mesh(boundary, 0.1);
+
+    for (auto i = 0u; i != mesh.get_nodes(); ++i)
+        ASSERT_EQ(i, mesh.get_index(mesh.get_locator(i)));
+
+    auto centre = mesh.get_index(mesh.get_locator(Vec3f(0)));
+    ASSERT_TRUE(mesh.inside(centre));
+    ASSERT_LT(mesh.get_position(mesh.get_locator(centre)).mag(), 0.1);
+
+    ASSERT_FALSE(mesh.inside(0));
+}
@@ -0,0 +1,77 @@
+#include "native_waveguide.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+/// The same update as the waveguide kernel, one node at a time.
+vector<vector<cl_float>> reference(const IterativeTetrahedralMesh & mesh,
+                                   size_t source,
+                                   const vector<size_t> & receivers,
+                                   size_t steps) {
+    vector<cl_float> previous(mesh.nodes.size(), 0);
+    vector<cl_float> current(mesh.nodes.size(), 0);
+    current[source] = 1;
+
+    vector<vector<cl_float>> ret(receivers.size());
+    for (auto step = 0u; step != steps; ++step) {
+        for (auto i = 0u; i != mesh.nodes.size(); ++i) {
+            cl_float temp = 0;
+            for (auto port : mesh.nodes[i].ports) {
+                if (port >= 0)
+                    temp += current[port];
+            }
+            temp /= 2;
+            temp -= previous[i];
+            previous[i] = temp;
+        }
+        swap(current, previous);
+        for (auto r = 0u; r != receivers.size(); ++r)
+            ret[r].push_back(current[receivers[r]]);
+    }
+    return ret;
+}
+
+TEST(native_waveguide, matches_reference) {
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralMesh mesh(boundary, 0.1);
+    NativeTetrahedralWaveguide waveguide(boundary, 0.1, 3);
+    ASSERT_EQ(mesh.nodes.size(), waveguide.get_nodes());
+
+    auto source = waveguide.get_index_for_coordinate(Vec3f(0));
+    vector<size_t> receivers{
+        waveguide.get_index_for_coordinate(Vec3f(0.5, 0, 0)),
+        waveguide.get_index_for_coordinate(Vec3f(0, -0.3, 0.6)),
+        source};
+
+    auto steps = 100u;
+    auto expected = reference(mesh, source, receivers, steps);
+    auto actual = waveguide.run(source, receivers, steps);
+
+    ASSERT_EQ(expected, actual);
+
+    auto non_zero = false;
+    for (auto i : actual.front())
+        non_zero = non_zero || i != 0;
+    ASSERT_TRUE(non_zero);
+}
+
+TEST(native_waveguide, temporal_blocking_matches_reference) {
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralMesh mesh(boundary, 0.05, true);
+    NativeTetrahedralWaveguide waveguide(boundary, 0.05, 2, 4);
+    ASSERT_LT(NativeTetrahedralWaveguide::TILE_NODES, mesh.nodes.size());
+
+    auto source = waveguide.get_index_for_coordinate(Vec3f(0.1, 0, 0));
+    vector<size_t> receivers{
+        waveguide.get_index_for_coordinate(Vec3f(-0.5, 0.2, 0)),
+        waveguide.get_index_for_coordinate(Vec3f(0, 0.7, 0.1)),
+        source};
+
+    //  not a multiple of the blocking factor
+    auto steps = 101u;
+    auto expected = reference(mesh, source, receivers, steps);
+    auto actual = waveguide.run(source, receivers, steps);
+
+    ASSERT_EQ(expected, actual);
+}
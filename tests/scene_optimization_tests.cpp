@@ -0,0 +1,190 @@
+#include "scene_optimization.h"
+#include "conversions.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+/// A flat n * n grid of quads in the plane y = 0, where every triangle has
+/// its own copy of its vertices.
+SceneData fragmented_grid(int n, cl_ulong surface = 0) {
+    vector<Triangle> triangles;
+    vector<cl_float3> vertices;
+    auto add_triangle = [&](Vec3f a, Vec3f b, Vec3f c) {
+        auto i = vertices.size();
+        for (auto v : {a, b, c})
+            vertices.push_back(convert(v));
+        triangles.push_back(Triangle{surface, i, i + 1, i + 2});
+    };
+
+    for (auto i = 0; i != n; ++i) {
+        for (auto j = 0; j != n; ++j) {
+            Vec3f a(i, 0, j), b(i + 1, 0, j);
+            Vec3f c(i + 1, 0, j + 1), d(i, 0, j + 1);
+            add_triangle(a, c, b);
+            add_triangle(a, d, c);
+        }
+    }
+
+    return SceneData(triangles, vertices, vector<Surface>(2));
+}
+
+float total_area(const SceneData & scene) {
+    auto ret = 0.0f;
+    for (const auto & t : scene.triangles) {
+        auto v0 = convert(scene.vertices[t.v0]);
+        ret += (convert(scene.vertices[t.v1]) - v0)
+                   .cross(convert(scene.vertices[t.v2]) - v0)
+                   .mag() /
+               2;
+    }
+    return ret;
+}
+
+TEST(scene_optimization, weld) {
+    auto scene = fragmented_grid(2);
+    weld_vertices(scene, 0.0001);
+    ASSERT_EQ(9u, scene.vertices.size());
+    ASSERT_EQ(8u, scene.triangles.size());
+}
+
+TEST(scene_optimization, weld_distance) {
+    //  the first pair is very close, but would round to different cells of
+    //  a grid with the weld distance as its spacing, and the second pair is
+    //  further apart than the weld distance, but would round to the same cell
+    vector<cl_float3> vertices{{{0.015f - 1e-6f, 0, 0}},
+                               {{0.015f + 1e-6f, 0, 0}},
+                               {{0.0155f, 0.0155f, 0.0155f}},
+                               {{0.0245f, 0.0245f, 0.0245f}}};
+    vector<Triangle> triangles{Triangle{0, 0, 1, 2}, Triangle{0, 1, 2, 3}};
+    SceneData scene(triangles, vertices, vector<Surface>(1));
+    weld_vertices(scene, 0.01);
+    ASSERT_EQ(3u, scene.vertices.size());
+    ASSERT_EQ(scene.triangles[0].v0, scene.triangles[0].v1);
+    ASSERT_NE(scene.triangles[1].v1, scene.triangles[1].v2);
+}
+
+TEST(scene_optimization, degenerate) {
+    vector<cl_float3> vertices{
+        {{0, 0, 0}}, {{1, 0, 0}}, {{0, 0, 1}}, {{2, 0, 0}}};
+    vector<Triangle> triangles{Triangle{0, 0, 2, 1},
+                               Triangle{0, 0, 0, 1},
+                               Triangle{0, 0, 1, 3},
+                               Triangle{0, 1, 0, 2}};
+    SceneData scene(triangles, vertices, vector<Surface>(1));
+    remove_degenerate_triangles(scene, 0.0001);
+    ASSERT_EQ(1u, scene.triangles.size());
+}
+
+TEST(scene_optimization, duplicates_keep_sides_and_surfaces) {
+    vector<cl_float3> vertices{{{0, 0, 0}}, {{1, 0, 0}}, {{0, 0, 1}}};
+    vector<Triangle> triangles{Triangle{0, 0, 2, 1},
+                               Triangle{0, 0, 1, 2},
+                               Triangle{1, 0, 2, 1},
+                               Triangle{0, 2, 1, 0}};
+    SceneData scene(triangles, vertices, vector<Surface>(2));
+    remove_degenerate_triangles(scene, 0.0001);
+
+    //  only the last triangle, which is the first rotated, is removed
+    ASSERT_EQ(3u, scene.triangles.size());
+    ASSERT_EQ(1u, scene.triangles[2].surface);
+}
+
+TEST(scene_optimization, coplanar) {
+    auto scene = fragmented_grid(4);
+    auto area = total_area(scene);
+    auto results = optimize_scene(scene);
+    ASSERT_EQ(32u, results.triangles_before);
+    ASSERT_EQ(2u, results.triangles_after);
+    ASSERT_EQ(4u, results.vertices_after);
+    ASSERT_NEAR(area, total_area(scene), 0.0001);
+}
+
+TEST(scene_optimization, keeps_surface_boundaries) {
+    auto a = fragmented_grid(2, 0);
+    auto b = fragmented_grid(2, 1);
+    for (auto & v : b.vertices)
+        v.s[0] += 2;
+    for (auto t : b.triangles) {
+        t.v0 += a.vertices.size();
+        t.v1 += a.vertices.size();
+        t.v2 += a.vertices.size();
+        a.triangles.push_back(t);
+    }
+    a.vertices.insert(a.vertices.end(), b.vertices.begin(), b.vertices.end());
+
+    optimize_scene(a);
+    //  the vertex in the middle of the shared edge must be kept
+    ASSERT_EQ(6u, a.triangles.size());
+    ASSERT_NEAR(8, total_area(a), 0.0001);
+}
+
+/// A closed unit cube where each face is an n * n grid of quads, and each
+/// face either has its own surface or shares surface 0.
+SceneData subdivided_cube(int n, bool surface_per_face) {
+    vector<Triangle> triangles;
+    vector<cl_float3> vertices;
+    auto face = 0u;
+    auto add_face = [&](Vec3f origin, Vec3f u, Vec3f v) {
+        auto base = vertices.size();
+        for (auto i = 0; i != n + 1; ++i)
+            for (auto j = 0; j != n + 1; ++j)
+                vertices.push_back(
+                    convert(origin + u * (float(i) / n) + v * (float(j) / n)));
+        auto index = [&](auto i, auto j) { return base + i * (n + 1) + j; };
+        cl_ulong surface = surface_per_face ? face : 0;
+        for (auto i = 0; i != n; ++i) {
+            for (auto j = 0; j != n; ++j) {
+                triangles.push_back(Triangle{surface,
+                                             index(i, j),
+                                             index(i + 1, j),
+                                             index(i + 1, j + 1)});
+                triangles.push_back(Triangle{surface,
+                                             index(i, j),
+                                             index(i + 1, j + 1),
+                                             index(i, j + 1)});
+            }
+        }
+        face += 1;
+    };
+
+    add_face(Vec3f(0, 0, 0), Vec3f(0, 1, 0), Vec3f(1, 0, 0));
+    add_face(Vec3f(0, 0, 1), Vec3f(1, 0, 0), Vec3f(0, 1, 0));
+    add_face(Vec3f(0, 0, 0), Vec3f(0, 0, 1), Vec3f(0, 1, 0));
+    add_face(Vec3f(1, 0, 0), Vec3f(0, 1, 0), Vec3f(0, 0, 1));
+    add_face(Vec3f(0, 0, 0), Vec3f(1, 0, 0), Vec3f(0, 0, 1));
+    add_face(Vec3f(0, 1, 0), Vec3f(0, 0, 1), Vec3f(1, 0, 0));
+
+    SceneData scene(triangles, vertices, vector<Surface>(6));
+    weld_vertices(scene, 0.0001);
+    return scene;
+}
+
+TEST(scene_optimization, simplify) {
+    auto scene = subdivided_cube(4, false);
+    ASSERT_EQ(192u, scene.triangles.size());
+    auto simplified = simplify_scene(scene, 12);
+    ASSERT_EQ(12u, simplified.triangles.size());
+    ASSERT_NEAR(6, total_area(simplified), 0.0001);
+}
+
+TEST(scene_optimization, simplify_keeps_surfaces) {
+    auto scene = subdivided_cube(4, true);
+    auto simplified = simplify_scene(scene, 0);
+    for (auto surface = 0u; surface != 6; ++surface) {
+        SceneData face(simplified);
+        face.triangles.clear();
+        for (const auto & t : simplified.triangles)
+            if (t.surface == surface)
+                face.triangles.push_back(t);
+        ASSERT_NEAR(1, total_area(face), 0.0001);
+    }
+}
+
+TEST(scene_optimization, lod_chain) {
+    auto scene = subdivided_cube(8, false);
+    auto chain = build_lod_chain(scene, 2, 0.25);
+    ASSERT_EQ(2u, chain.size());
+    ASSERT_LE(chain[0].triangles.size(), scene.triangles.size() / 4);
+    ASSERT_LE(chain[1].triangles.size(), chain[0].triangles.size() / 4);
+}
@@ -0,0 +1,117 @@
+#include "slab_decomposition.h"
+#include "native_waveguide.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+/// Step each slab on its own, reading back the nodes other slabs need and
+/// writing halos with SlabDecomposition::exchange after every step, in the
+/// same way as DistributedTetrahedralWaveguide.
+/// The device side of that class (buffer offsets, the order of its queued
+/// commands) is only covered by distributed_waveguide_tests, which needs a
+/// device.
+vector<vector<cl_float>> run_slabs(const SlabDecomposition & decomposition,
+                                   size_t source,
+                                   const vector<size_t> & receivers,
+                                   size_t steps) {
+    const auto & slabs = decomposition.slabs;
+    vector<vector<cl_float>> current;
+    vector<vector<cl_float>> previous;
+    for (const auto & slab : slabs) {
+        current.emplace_back(slab.nodes.size(), 0);
+        previous.emplace_back(slab.nodes.size(), 0);
+        for (auto j = 0u; j != slab.nodes.size(); ++j)
+            current.back()[j] = slab.nodes[j] == source ? 1 : 0;
+    }
+
+    auto update = [](const auto & slab,
+                     const auto & list,
+                     const auto & current,
+                     auto & previous) {
+        for (auto j : list) {
+            cl_float temp = 0;
+            for (auto port : slab.ports[j].s) {
+                if (port >= 0)
+                    temp += current[port];
+            }
+            temp /= 2;
+            temp -= previous[j];
+            previous[j] = temp;
+        }
+    };
+
+    vector<vector<cl_float>> sent(slabs.size());
+    vector<vector<cl_float>> halo;
+    vector<vector<cl_float>> ret(receivers.size());
+    for (auto step = 0u; step != steps; ++step) {
+        for (auto d = 0u; d != slabs.size(); ++d) {
+            update(slabs[d], slabs[d].send_list, current[d], previous[d]);
+            update(slabs[d], slabs[d].rest_list, current[d], previous[d]);
+        }
+        for (auto d = 0u; d != slabs.size(); ++d) {
+            sent[d].assign(previous[d].begin(),
+                           previous[d].begin() + slabs[d].send);
+        }
+        decomposition.exchange(sent, halo);
+        for (auto d = 0u; d != slabs.size(); ++d) {
+            copy(halo[d].begin(),
+                 halo[d].end(),
+                 previous[d].begin() + slabs[d].get_owned());
+        }
+        swap(current, previous);
+        for (auto r = 0u; r != receivers.size(); ++r) {
+            auto d = decomposition.get_slab(receivers[r]);
+            ret[r].push_back(
+                current[d][decomposition.get_local_index(receivers[r])]);
+        }
+    }
+    return ret;
+}
+
+TEST(slab_decomposition, matches_single_mesh) {
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralMesh mesh(boundary, 0.1);
+    NativeTetrahedralWaveguide waveguide(boundary, 0.1, 1);
+
+    auto source = waveguide.get_index_for_coordinate(Vec3f(0.2, 0, 0));
+    vector<size_t> receivers{
+        waveguide.get_index_for_coordinate(Vec3f(0, 0, -0.7)),
+        waveguide.get_index_for_coordinate(Vec3f(0, 0.1, 0.6)),
+        source};
+
+    auto steps = 100u;
+    auto expected = waveguide.run(source, receivers, steps);
+
+    for (auto count : {1u, 3u, 7u}) {
+        SlabDecomposition decomposition(mesh.nodes, count);
+        for (const auto & slab : decomposition.slabs) {
+            for (const auto & from : slab.halo_sources)
+                ASSERT_LT(from.second, decomposition.slabs[from.first].send);
+        }
+        ASSERT_EQ(expected, run_slabs(decomposition, source, receivers, steps));
+    }
+}
+
+TEST(slab_decomposition, exchange_fills_halos) {
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralMesh mesh(boundary, 0.1);
+    SlabDecomposition decomposition(mesh.nodes, 5);
+
+    //  each slab sends the mesh indices of its nodes, so every halo should
+    //  end up holding the mesh indices of its own halo nodes
+    vector<vector<size_t>> sent;
+    for (const auto & slab : decomposition.slabs)
+        sent.emplace_back(slab.nodes.begin(), slab.nodes.begin() + slab.send);
+
+    vector<vector<size_t>> halo;
+    decomposition.exchange(sent, halo);
+    ASSERT_EQ(decomposition.slabs.size(), halo.size());
+    for (auto d = 0u; d != halo.size(); ++d) {
+        const auto & slab = decomposition.slabs[d];
+        ASSERT_FALSE(halo[d].empty());
+        ASSERT_EQ(vector<size_t>(slab.nodes.begin() + slab.get_owned(),
+                                 slab.nodes.end()),
+                  halo[d]);
+    }
+}
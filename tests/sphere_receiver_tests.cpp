@@ -0,0 +1,39 @@
+#include "sphere_receiver.h"
+
+#include "gtest/gtest.h"
+
+#include <cmath>
+
+/// Trace a square grid of parallel rays past a sphere at the origin and sum
+/// the weights of the rays which pass through it.
+float sphere_receiver_total(float receiver_radius, float spacing) {
+    const auto start = -5.0f;
+    const auto segment_length = 10.0f;
+    const auto extent = 1.5f;
+    auto total = 0.0f;
+    for (auto x = -extent; x < extent; x += spacing) {
+        for (auto y = -extent; y < extent; y += spacing) {
+            auto chord = sphere_receiver_chord(
+                -start, x * x + y * y, segment_length, receiver_radius);
+            total += sphere_receiver_weight(chord, receiver_radius);
+        }
+    }
+    return total;
+}
+
+TEST(sphere_receiver, total_independent_of_radius) {
+    const auto spacing = 0.005f;
+    auto small = sphere_receiver_total(0.25, spacing);
+    auto large = sphere_receiver_total(1, spacing);
+    ASSERT_NEAR(1, small / large, 0.01);
+
+    //  the total is 4 pi times the number of rays per unit area
+    ASSERT_NEAR(1, large * spacing * spacing / (4 * M_PI), 0.01);
+}
+
+TEST(sphere_receiver, segment_ends_inside) {
+    //  a segment which stops at the centre only crosses half the sphere
+    ASSERT_FLOAT_EQ(1, sphere_receiver_chord(2, 0, 2, 1));
+    ASSERT_FLOAT_EQ(0, sphere_receiver_chord(2, 0, 0.5, 1));
+    ASSERT_FLOAT_EQ(0, sphere_receiver_chord(2, 1, 4, 1));
+}
@@ -0,0 +1,49 @@
+#include "streaming_waveguide.h"
+#include "native_waveguide.h"
+#include "device_tests.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+TEST(streaming_waveguide, matches_native) {
+    if (!has_opencl_platform()) {
+        cerr << "no OpenCL platform, skipping streaming waveguide test"
+             << endl;
+        return;
+    }
+
+    auto context = get_context();
+    auto device = get_device(context);
+    cl::CommandQueue queue(context, device);
+    auto program = get_program<TetrahedralProgram>(context, device);
+
+    SphereBoundary boundary(Vec3f(0), 1);
+    NativeTetrahedralWaveguide native(boundary, 0.1, 1);
+    auto source = native.get_index_for_coordinate(Vec3f(0.2, 0, 0));
+    vector<size_t> receivers{
+        native.get_index_for_coordinate(Vec3f(0, 0, -0.7)),
+        native.get_index_for_coordinate(Vec3f(0, 0.1, 0.6)),
+        source};
+
+    //  not a multiple of any blocking factor, so the last block is short
+    auto steps = 101u;
+    auto expected = native.run(source, receivers, steps);
+
+    //  small slabs put the receivers in different slabs, which alternate
+    //  between the two slots, and one large slab has no halo at all
+    for (auto slab_nodes : {500u, 3000u, 100000u}) {
+        for (auto blocking_factor : {1u, 4u, 8u}) {
+            StreamingTetrahedralWaveguide waveguide(
+                program, queue, boundary, 0.1, slab_nodes, blocking_factor);
+            auto actual = waveguide.run(source, receivers, steps);
+
+            ASSERT_EQ(expected.size(), actual.size());
+            for (auto r = 0u; r != expected.size(); ++r) {
+                ASSERT_EQ(expected[r].size(), actual[r].size());
+                for (auto i = 0u; i != expected[r].size(); ++i)
+                    ASSERT_NEAR(expected[r][i], actual[r][i], 1e-5);
+            }
+        }
+    }
+}
@@ -0,0 +1,228 @@
+#include "waveguide.h"
+#include "native_waveguide.h"
+#include "device_tests.h"
+
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+TEST(tetrahedral_waveguide, distances_match_first_arrival) {
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralMesh mesh(boundary, 0.1);
+    NativeTetrahedralWaveguide waveguide(boundary, 0.1, 1);
+
+    auto source = waveguide.get_index_for_coordinate(Vec3f(0.2, 0, 0));
+    vector<cl_float> initial(mesh.nodes.size(), 0);
+    initial[source] = 1;
+    auto distances = TetrahedralWaveguide::get_distances(
+        TetrahedralWaveguide::get_ports(mesh.nodes), initial);
+    ASSERT_EQ(0u, distances[source]);
+
+    vector<size_t> receivers;
+    for (auto i = 0u; i < mesh.nodes.size(); i += 97)
+        receivers.push_back(i);
+
+    //  a node n connections from the source is zero until step n, where
+    //  the first wavefront reaches it
+    auto steps = 30u;
+    auto signals = waveguide.run(source, receivers, steps);
+    for (auto r = 0u; r != receivers.size(); ++r) {
+        auto distance = distances[receivers[r]];
+        ASSERT_NE(cl_uint(-1), distance);
+        for (auto i = 0u; i != steps && i + 1 < distance; ++i) {
+            ASSERT_EQ(0, signals[r][i]);
+        }
+        if (0 < distance && distance <= steps) {
+            ASSERT_NE(0, signals[r][distance - 1]);
+        }
+    }
+}
+
+TEST(tetrahedral_waveguide, active_list) {
+    vector<cl_uint> distances{2, 0, cl_uint(-1), 1, 0, 2, 7};
+    TetrahedralWaveguide::ActiveList list({0, 1, 2, 3, 4, 5}, distances);
+
+    //  equal distances keep their order, and node 2 is unreachable
+    ASSERT_EQ((vector<cl_uint>{1, 4, 3, 0, 5, 2}), list.nodes);
+    ASSERT_EQ((vector<TetrahedralWaveguide::size_type>{2, 3, 5}),
+              list.within);
+}
+
+TEST(tetrahedral_waveguide, active_region_matches_full_mesh) {
+    if (!has_opencl_platform()) {
+        cerr << "no OpenCL platform, skipping active region test" << endl;
+        return;
+    }
+
+    auto context = get_context();
+    auto device = get_device(context);
+    cl::CommandQueue queue(context, device);
+    auto program = get_program<TetrahedralProgram>(context, device);
+
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralWaveguide waveguide(program, queue, boundary, 0.1);
+    auto source = Vec3f(0.2, 0, 0);
+    vector<size_t> receivers{
+        waveguide.get_index_for_coordinate(Vec3f(0, 0, -0.7)),
+        waveguide.get_index_for_coordinate(Vec3f(0, 0.1, 0.6)),
+        waveguide.get_index_for_coordinate(source)};
+
+    //  long enough for the region to cover the mesh part way through
+    auto steps = 100u;
+    auto expected = waveguide.run_basic(source, receivers, steps);
+    waveguide.set_active_region(true);
+    ASSERT_EQ(expected, waveguide.run_basic(source, receivers, steps));
+}
+
+TEST(tetrahedral_waveguide, decay_check) {
+    BasicWaveguide::DecayCheck disabled(0);
+    ASSERT_FALSE(disabled.is_enabled());
+    for (auto energy : {1.0f, 0.0f})
+        ASSERT_FALSE(disabled(energy));
+
+    //  20dB below a peak of 4 is 0.04
+    BasicWaveguide::DecayCheck decayed(20);
+    ASSERT_TRUE(decayed.is_enabled());
+    for (auto energy : {1.0f, 4.0f, 2.0f, 0.05f})
+        ASSERT_FALSE(decayed(energy));
+    ASSERT_TRUE(decayed(0.039f));
+}
+
+TEST(tetrahedral_waveguide, stops_once_decayed) {
+    if (!has_opencl_platform()) {
+        cerr << "no OpenCL platform, skipping decay test" << endl;
+        return;
+    }
+
+    auto context = get_context();
+    auto device = get_device(context);
+    cl::CommandQueue queue(context, device);
+    auto program = get_program<TetrahedralProgram>(context, device);
+
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralWaveguide waveguide(program, queue, boundary, 0.1);
+    auto source = Vec3f(0.2, 0, 0);
+    vector<size_t> receivers{
+        waveguide.get_index_for_coordinate(Vec3f(0, 0, -0.7)),
+        waveguide.get_index_for_coordinate(source)};
+
+    auto steps = 1000u;
+    auto chunk = 50u;
+    waveguide.set_steps_per_sync(chunk);
+    auto full = waveguide.run_basic(source, receivers, steps);
+
+    //  the mesh has no losses, so only a small threshold is crossed, as the
+    //  potential energy rises and falls
+    //  the run stops at the end of a chunk, and up to there it matches the
+    //  full run
+    waveguide.set_decay_threshold(0.3);
+    auto stopped = waveguide.run_basic(source, receivers, steps);
+    ASSERT_EQ(receivers.size(), stopped.size());
+    auto length = stopped.front().size();
+    ASSERT_LT(length, steps);
+    ASSERT_EQ(0u, length % chunk);
+    for (auto r = 0u; r != receivers.size(); ++r) {
+        ASSERT_EQ(vector<cl_float>(full[r].begin(), full[r].begin() + length),
+                  stopped[r]);
+    }
+}
+
+TEST(tetrahedral_waveguide, multiple_sources_match_single_runs) {
+    if (!has_opencl_platform()) {
+        cerr << "no OpenCL platform, skipping multiple source test" << endl;
+        return;
+    }
+
+    auto context = get_context();
+    auto device = get_device(context);
+    cl::CommandQueue queue(context, device);
+    auto program = get_program<TetrahedralProgram>(context, device);
+
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralWaveguide waveguide(program, queue, boundary, 0.1);
+    vector<size_t> receivers{
+        waveguide.get_index_for_coordinate(Vec3f(0, 0, -0.7)),
+        waveguide.get_index_for_coordinate(Vec3f(0, 0.1, 0.6))};
+
+    //  five sources leave a partly filled second group of lanes
+    vector<Vec3f> positions{Vec3f(0.2, 0, 0),
+                            Vec3f(-0.3, 0.1, 0),
+                            Vec3f(0, 0.4, -0.2),
+                            Vec3f(0.1, -0.5, 0.3),
+                            Vec3f(-0.2, -0.2, -0.4)};
+    ASSERT_LT(IterativeTetrahedralWaveguide::SOURCE_LANES, positions.size());
+
+    IterativeTetrahedralWaveguide::BasicPowerFunction u;
+    vector<IterativeTetrahedralWaveguide::Source> sources;
+    for (const auto & i : positions) {
+        sources.push_back({waveguide.get_coordinate_for_index(
+                               waveguide.get_index_for_coordinate(i)),
+                           u});
+    }
+
+    auto steps = 100u;
+    auto multiple = waveguide.run_multiple_sources(sources, receivers, steps);
+    ASSERT_EQ(positions.size(), multiple.size());
+
+    //  the vector kernel may be compiled with different rounding from the
+    //  scalar one, so allow a small error relative to the peak of each signal
+    for (auto s = 0u; s != positions.size(); ++s) {
+        auto single = waveguide.run_basic(positions[s], receivers, steps);
+        ASSERT_EQ(receivers.size(), multiple[s].size());
+        for (auto r = 0u; r != receivers.size(); ++r) {
+            ASSERT_EQ(steps, multiple[s][r].size());
+            auto peak = 0.0f;
+            for (auto i : single[r])
+                peak = max(peak, fabs(i));
+            for (auto i = 0u; i != steps; ++i) {
+                ASSERT_NEAR(single[r][i], multiple[s][r][i], 1e-5 * peak);
+            }
+        }
+    }
+}
+
+TEST(tetrahedral_waveguide, half_fields_match_float_fields) {
+    if (!has_opencl_platform()) {
+        cerr << "no OpenCL platform, skipping half field test" << endl;
+        return;
+    }
+
+    auto context = get_context();
+    auto device = get_device(context);
+    cl::CommandQueue queue(context, device);
+    auto program = get_program<TetrahedralProgram>(context, device);
+
+    SphereBoundary boundary(Vec3f(0), 1);
+    IterativeTetrahedralWaveguide full(program, queue, boundary, 0.1);
+    IterativeTetrahedralWaveguide half(
+        program, queue, boundary, 0.1, false, true);
+    ASSERT_TRUE(half.get_half_fields());
+
+    auto source = Vec3f(0.2, 0, 0);
+    vector<size_t> receivers{
+        full.get_index_for_coordinate(Vec3f(0, 0, -0.7)),
+        full.get_index_for_coordinate(Vec3f(0, 0.1, 0.6)),
+        full.get_index_for_coordinate(source)};
+
+    auto steps = 100u;
+    auto expected = full.run_basic(source, receivers, steps);
+    auto actual = half.run_basic(source, receivers, steps);
+    ASSERT_EQ(expected.size(), actual.size());
+
+    //  half precision keeps about three significant figures per step, and
+    //  the rounding builds up over the run, so each output only has to be
+    //  within 2% of the peak of the float signal
+    for (auto r = 0u; r != receivers.size(); ++r) {
+        ASSERT_EQ(expected[r].size(), actual[r].size());
+        auto peak = 0.0f;
+        for (auto i : expected[r])
+            peak = max(peak, fabs(i));
+        ASSERT_LT(0, peak);
+        for (auto i = 0u; i != steps; ++i) {
+            ASSERT_NEAR(expected[r][i], actual[r][i], 0.02 * peak);
+        }
+    }
+}